@@ -0,0 +1,93 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2013 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <sstream>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Wt/WApplication>
+#include <Wt/WText>
+#include <Wt/Wc/EtagStore.hpp>
+
+using namespace Wt;
+using namespace Wt::Wc;
+
+const int BEACON_REQUESTS = 100000;
+
+std::string beacon_bench_run(const std::string& name,
+                             EtagStoreResource& resource,
+                             const std::string& cookies,
+                             const std::string& etag_value) {
+    using namespace boost::posix_time;
+    ptime start = microsec_clock::universal_time();
+    int not_modified = 0;
+    std::string value;
+    for (int i = 0; i < BEACON_REQUESTS; ++i) {
+        value = etag_value;
+        if (resource.handle_headers(cookies, value)) {
+            not_modified += 1;
+        }
+    }
+    double seconds = (microsec_clock::universal_time() - start)
+                     .total_microseconds() / 1e6;
+    std::stringstream report;
+    report << name << ": " << (seconds * 1e9 / BEACON_REQUESTS) <<
+           " ns per request (" << not_modified << " not modified)" <<
+           std::endl;
+    return report.str();
+}
+
+std::string beacon_bench_report(EtagStoreResource& resource,
+                                const std::string& cookie_value) {
+    std::string known = "_ga=GA1.2.3; " + resource.cookie_name() + "=" +
+                        cookie_value + "; lang=en";
+    std::string unknown = "_ga=GA1.2.3; " + resource.cookie_name() +
+                          "=unknown; lang=en";
+    std::string etag_value = "&lang=en&theme=dark";
+    std::stringstream report;
+    report << BEACON_REQUESTS << " requests" << std::endl;
+    report << beacon_bench_run("known client, 304 Not Modified",
+                               resource, known, etag_value);
+    report << beacon_bench_run("unknown client", resource,
+                               unknown, etag_value);
+    report << beacon_bench_run("no cookie", resource, "lang=en", "");
+    return report.str();
+}
+
+/* The client is registered by EtagStore, which needs a session */
+class BenchBeaconApp : public WApplication {
+public:
+    BenchBeaconApp(const WEnvironment& env):
+        WApplication(env) {
+        new WText("Cost of a request of the image of EtagStoreResource ",
+                  root());
+        new WText("(internal check)", root());
+        resource_ = new EtagStoreResource;
+        store_ = new EtagStore(resource_, root());
+        std::string report = beacon_bench_report(*resource_,
+                             store_->cookie_value());
+        new WText("<pre>" + report + "</pre>", root());
+    }
+
+    ~BenchBeaconApp() {
+        // the store uses the resource
+        delete store_;
+        delete resource_;
+    }
+
+private:
+    EtagStoreResource* resource_;
+    EtagStore* store_;
+};
+
+WApplication* createBenchBeaconApp(const WEnvironment& env) {
+    return new BenchBeaconApp(env);
+}
+
+int main(int argc, char** argv) {
+    return WRun(argc, argv, &createBenchBeaconApp);
+}
+
@@ -0,0 +1,132 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Wt/WApplication>
+#include <Wt/WText>
+#include <Wt/Wc/util.hpp>
+
+using namespace Wt;
+using namespace Wt::Wc;
+
+const size_t ESCAPE_INPUT_SIZE = 4 * 1024 * 1024;
+const int ESCAPE_REPEAT = 5;
+
+typedef void (*EscapeFunc)(const std::string& in, std::string& out);
+
+void escape_bench_urlencode(const std::string& in, std::string& out) {
+    out = urlencode(in);
+}
+
+void escape_bench_urlencode_append(const std::string& in, std::string& out) {
+    out.clear();
+    urlencode(in, out);
+}
+
+void escape_bench_urldecode(const std::string& in, std::string& out) {
+    out = urldecode(in);
+}
+
+void escape_bench_urldecode_append(const std::string& in, std::string& out) {
+    out.clear();
+    urldecode(in, out);
+}
+
+void escape_bench_json(const std::string& in, std::string& out) {
+    out = json_escape_utf8(in);
+}
+
+void escape_bench_json_append(const std::string& in, std::string& out) {
+    out.clear();
+    json_escape_utf8(in, out);
+}
+
+std::string escape_bench_input(const std::string& sample) {
+    std::string result;
+    result.reserve(ESCAPE_INPUT_SIZE + sample.size());
+    while (result.size() < ESCAPE_INPUT_SIZE) {
+        result += sample;
+    }
+    return result;
+}
+
+std::string escape_bench_run(const std::string& name, EscapeFunc func,
+                             const std::string& input) {
+    using namespace boost::posix_time;
+    std::string out;
+    func(input, out); // warm up
+    ptime start = microsec_clock::universal_time();
+    size_t checksum = 0;
+    for (int i = 0; i < ESCAPE_REPEAT; ++i) {
+        func(input, out);
+        checksum += out.size();
+    }
+    double seconds = (microsec_clock::universal_time() - start)
+                     .total_microseconds() / 1e6;
+    double mb = double(input.size()) * ESCAPE_REPEAT / (1024 * 1024);
+    std::stringstream report;
+    report << name << ": " << (mb / seconds) << " MiB/s" <<
+           " (output " << checksum / ESCAPE_REPEAT << " bytes)" << std::endl;
+    return report.str();
+}
+
+std::string escape_bench_report() {
+    // path and query of typical URL
+    std::string ascii = escape_bench_input("/user/profile/12345?tab=photos&"
+                                           "sort=date desc&q=New York ");
+    // Russian text
+    std::string utf8 = escape_bench_input("\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2"
+                                          "\xd0\xb5\xd1\x82, \xd0\xbc\xd0\xb8"
+                                          "\xd1\x80! ");
+    std::string encoded = urlencode(ascii);
+    std::stringstream report;
+    report << "input of " << ESCAPE_INPUT_SIZE / (1024 * 1024) << " MiB, " <<
+           ESCAPE_REPEAT << " runs" << std::endl;
+    report << escape_bench_run("urlencode (ASCII)",
+                               escape_bench_urlencode, ascii);
+    report << escape_bench_run("urlencode to buffer (ASCII)",
+                               escape_bench_urlencode_append, ascii);
+    report << escape_bench_run("urlencode (UTF-8)",
+                               escape_bench_urlencode, utf8);
+    report << escape_bench_run("urldecode",
+                               escape_bench_urldecode, encoded);
+    report << escape_bench_run("urldecode to buffer",
+                               escape_bench_urldecode_append, encoded);
+    report << escape_bench_run("json_escape_utf8 (ASCII)",
+                               escape_bench_json, ascii);
+    report << escape_bench_run("json_escape_utf8 (UTF-8)",
+                               escape_bench_json, utf8);
+    report << escape_bench_run("json_escape_utf8 to buffer (UTF-8)",
+                               escape_bench_json_append, utf8);
+    return report.str();
+}
+
+class BenchEscapeApp : public WApplication {
+public:
+    BenchEscapeApp(const WEnvironment& env):
+        WApplication(env) {
+        new WText("Throughput of urlencode(), urldecode() and ", root());
+        new WText("json_escape_utf8() (internal check)", root());
+        new WText("<pre>" + escape_bench_report() + "</pre>", root());
+    }
+};
+
+WApplication* createBenchEscapeApp(const WEnvironment& env) {
+    return new BenchEscapeApp(env);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && std::string(argv[1]) == "--bench") {
+        std::cout << escape_bench_report();
+        return 0;
+    }
+    return WRun(argc, argv, &createBenchEscapeApp);
+}
+
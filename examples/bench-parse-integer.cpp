@@ -0,0 +1,108 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Wt/WApplication>
+#include <Wt/WText>
+#include <Wt/Wc/util.hpp>
+
+using namespace Wt;
+using namespace Wt::Wc;
+
+const int PARSE_ROUNDS = 200000;
+
+typedef bool (*ParseFunc)(const std::string& str, int& value);
+
+/* What IntegerNode did before parse_integer() */
+bool parse_bench_lexical_cast(const std::string& str, int& value) {
+    try {
+        value = boost::lexical_cast<int>(str);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool parse_bench_parse_integer(const std::string& str, int& value) {
+    return parse_integer(str, value);
+}
+
+std::string parse_bench_run(const std::string& name, ParseFunc func,
+                            const std::vector<std::string>& segments) {
+    using namespace boost::posix_time;
+    ptime start = microsec_clock::universal_time();
+    int numbers = 0;
+    long long sum = 0;
+    for (int round = 0; round < PARSE_ROUNDS; ++round) {
+        for (size_t i = 0; i < segments.size(); ++i) {
+            int value;
+            if (func(segments[i], value)) {
+                numbers += 1;
+                sum += value;
+            }
+        }
+    }
+    double seconds = (microsec_clock::universal_time() - start)
+                     .total_microseconds() / 1e6;
+    double calls = double(PARSE_ROUNDS) * segments.size();
+    std::stringstream report;
+    report << name << ": " << (seconds * 1e9 / calls) << " ns per segment" <<
+           " (" << numbers / PARSE_ROUNDS << " numbers, sum " <<
+           sum / PARSE_ROUNDS << ")" << std::endl;
+    return report.str();
+}
+
+std::string parse_bench_report() {
+    // segments of paths like /news/2013/page/42/, tested by IntegerNode
+    std::vector<std::string> segments;
+    segments.push_back("news");
+    segments.push_back("2013");
+    segments.push_back("page");
+    segments.push_back("42");
+    segments.push_back("photos");
+    segments.push_back("12x");
+    segments.push_back("-7");
+    segments.push_back("99999999999");
+    segments.push_back("wp-login.php");
+    segments.push_back("");
+    std::stringstream report;
+    report << "mixed path segments, " << segments.size() * PARSE_ROUNDS <<
+           " calls" << std::endl;
+    report << parse_bench_run("parse_integer()",
+                              parse_bench_parse_integer, segments);
+    report << parse_bench_run("boost::lexical_cast",
+                              parse_bench_lexical_cast, segments);
+    return report.str();
+}
+
+class BenchParseIntegerApp : public WApplication {
+public:
+    BenchParseIntegerApp(const WEnvironment& env):
+        WApplication(env) {
+        new WText("Cost of parse_integer() on mixed path segments ", root());
+        new WText("(internal check)", root());
+        new WText("<pre>" + parse_bench_report() + "</pre>", root());
+    }
+};
+
+WApplication* createBenchParseIntegerApp(const WEnvironment& env) {
+    return new BenchParseIntegerApp(env);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && std::string(argv[1]) == "--bench") {
+        std::cout << parse_bench_report();
+        return 0;
+    }
+    return WRun(argc, argv, &createBenchParseIntegerApp);
+}
+
@@ -0,0 +1,146 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Wt/WApplication>
+#include <Wt/WText>
+#include <Wt/Wc/util.hpp>
+
+using namespace Wt;
+using namespace Wt::Wc;
+
+const int QUEUE_PRODUCERS = 32;
+const int QUEUE_ITEMS = 50000; // per producer
+
+/* Queue used by one_bound_post<T>() */
+class LockFreeBenchQueue {
+public:
+    void push(int value) {
+        queue_.push(value);
+    }
+
+    int drain(long long& sum) {
+        typedef MpscQueue<int>::Node Node;
+        MpscQueue<int>::List list(queue_.take_all());
+        int n = 0;
+        while (Node* node = list.pop()) {
+            sum += node->value;
+            delete node;
+            n += 1;
+        }
+        return n;
+    }
+
+private:
+    MpscQueue<int> queue_;
+};
+
+/* Queue protected by mutex, drained by swap */
+class LockedBenchQueue {
+public:
+    void push(int value) {
+        boost::mutex::scoped_lock lock(mutex_);
+        queue_.push_back(value);
+    }
+
+    int drain(long long& sum) {
+        std::deque<int> values;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            values.swap(queue_);
+        }
+        for (size_t i = 0; i < values.size(); ++i) {
+            sum += values[i];
+        }
+        return values.size();
+    }
+
+private:
+    std::deque<int> queue_;
+    boost::mutex mutex_;
+};
+
+template <typename Queue>
+void queue_bench_produce(Queue* queue, boost::barrier* barrier) {
+    barrier->wait();
+    for (int i = 0; i < QUEUE_ITEMS; ++i) {
+        queue->push(i);
+    }
+}
+
+template <typename Queue>
+std::string queue_bench_run(const std::string& name) {
+    using namespace boost::posix_time;
+    Queue queue;
+    boost::barrier barrier(QUEUE_PRODUCERS + 1);
+    boost::thread_group producers;
+    for (int i = 0; i < QUEUE_PRODUCERS; ++i) {
+        producers.create_thread(boost::bind(queue_bench_produce<Queue>,
+                                            &queue, &barrier));
+    }
+    barrier.wait();
+    ptime start = microsec_clock::universal_time();
+    const int total = QUEUE_PRODUCERS * QUEUE_ITEMS;
+    int received = 0;
+    long long sum = 0;
+    // this thread is the consumer
+    while (received < total) {
+        int n = queue.drain(sum);
+        if (n == 0) {
+            boost::this_thread::yield();
+        }
+        received += n;
+    }
+    double seconds = (microsec_clock::universal_time() - start)
+                     .total_microseconds() / 1e6;
+    producers.join_all();
+    long long expected = (long long)(QUEUE_ITEMS - 1) * QUEUE_ITEMS / 2 *
+                         QUEUE_PRODUCERS;
+    std::stringstream report;
+    report << name << ": " << total << " values in " << seconds << " s, " <<
+           (seconds * 1e9 / total) << " ns per value" <<
+           (sum == expected ? "" : " (WRONG SUM)") << std::endl;
+    return report.str();
+}
+
+std::string queue_bench_report() {
+    std::stringstream report;
+    report << QUEUE_PRODUCERS << " producers, 1 consumer" << std::endl;
+    report << queue_bench_run<LockFreeBenchQueue>("MpscQueue");
+    report << queue_bench_run<LockedBenchQueue>("mutex and std::deque");
+    return report.str();
+}
+
+class BenchQueueApp : public WApplication {
+public:
+    BenchQueueApp(const WEnvironment& env):
+        WApplication(env) {
+        new WText("Contention of the queue of one_bound_post() ", root());
+        new WText("(internal check)", root());
+        new WText("<pre>" + queue_bench_report() + "</pre>", root());
+    }
+};
+
+WApplication* createBenchQueueApp(const WEnvironment& env) {
+    return new BenchQueueApp(env);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && std::string(argv[1]) == "--bench") {
+        std::cout << queue_bench_report();
+        return 0;
+    }
+    return WRun(argc, argv, &createBenchQueueApp);
+}
+
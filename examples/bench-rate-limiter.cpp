@@ -0,0 +1,163 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Wt/WApplication>
+#include <Wt/WText>
+#include <Wt/Wc/RateLimiter.hpp>
+#include <Wt/Wc/util.hpp>
+
+using namespace Wt;
+using namespace Wt::Wc;
+
+const int LIMITER_THREADS = 8;
+const int LIMITER_CALLS = 100000; // per thread
+const int LIMITER_ADDRESSES = 10000;
+
+/* What AbstractCaptcha::frequency_check() did before RateLimiter */
+class GlobalMapLimiter {
+public:
+    bool allow_address(const std::string& address) {
+        using namespace boost::posix_time;
+        ptime now = microsec_clock::universal_time();
+        boost::mutex::scoped_lock lock(mutex_);
+        ptime& last = last_[address];
+        if (!last.is_special() && now - last < seconds(1)) {
+            return false;
+        }
+        last = now;
+        return true;
+    }
+
+private:
+    std::map<std::string, boost::posix_time::ptime> last_;
+    boost::mutex mutex_;
+};
+
+/* RateLimiter without conversion of address to network */
+class KeyRateLimiter {
+public:
+    KeyRateLimiter():
+        limiter_(1.0, 10)
+    { }
+
+    bool allow_address(const std::string& address) {
+        return limiter_.allow(address);
+    }
+
+private:
+    RateLimiter limiter_;
+};
+
+template <typename Limiter>
+void limiter_bench_thread(Limiter* limiter,
+                          const std::vector<std::string>* addresses,
+                          int first, boost::barrier* barrier, int* allowed) {
+    barrier->wait();
+    int n = addresses->size();
+    for (int i = 0; i < LIMITER_CALLS; ++i) {
+        if (limiter->allow_address((*addresses)[(first + i) % n])) {
+            *allowed += 1;
+        }
+    }
+}
+
+template <typename Limiter>
+std::string limiter_bench_run(const std::string& name, Limiter& limiter,
+                              const std::vector<std::string>& addresses) {
+    using namespace boost::posix_time;
+    boost::barrier barrier(LIMITER_THREADS + 1);
+    boost::thread_group threads;
+    std::vector<int> allowed(LIMITER_THREADS, 0);
+    for (int i = 0; i < LIMITER_THREADS; ++i) {
+        int first = i * addresses.size() / LIMITER_THREADS;
+        threads.create_thread(boost::bind(limiter_bench_thread<Limiter>,
+                                          &limiter, &addresses, first,
+                                          &barrier, &allowed[i]));
+    }
+    barrier.wait();
+    ptime start = microsec_clock::universal_time();
+    threads.join_all();
+    double seconds = (microsec_clock::universal_time() - start)
+                     .total_microseconds() / 1e6;
+    int total_allowed = 0;
+    for (int i = 0; i < LIMITER_THREADS; ++i) {
+        total_allowed += allowed[i];
+    }
+    double calls = double(LIMITER_THREADS) * LIMITER_CALLS;
+    std::stringstream report;
+    report << name << ": " << (seconds * 1e9 / calls) << " ns per call" <<
+           " (" << total_allowed << " allowed)" << std::endl;
+    return report.str();
+}
+
+std::string limiter_bench_report() {
+    std::vector<std::string> addresses;
+    for (int i = 0; i < LIMITER_ADDRESSES; ++i) {
+        addresses.push_back("10." + TO_S(i / 65536 % 256) + "." +
+                            TO_S(i / 256 % 256) + "." + TO_S(i % 256));
+    }
+    std::vector<std::string> one_address(1, "10.0.0.1");
+    std::stringstream report;
+    report << LIMITER_THREADS << " threads, " << LIMITER_CALLS <<
+           " calls per thread" << std::endl;
+    {
+        RateLimiter limiter(1.0, 10);
+        report << limiter_bench_run("RateLimiter, " +
+                                    TO_S(LIMITER_ADDRESSES) + " addresses",
+                                    limiter, addresses);
+    }
+    {
+        KeyRateLimiter limiter;
+        report << limiter_bench_run("RateLimiter.allow(), " +
+                                    TO_S(LIMITER_ADDRESSES) + " keys",
+                                    limiter, addresses);
+    }
+    {
+        RateLimiter limiter(1.0, 10);
+        report << limiter_bench_run("RateLimiter, one address",
+                                    limiter, one_address);
+    }
+    {
+        GlobalMapLimiter limiter;
+        report << limiter_bench_run("global mutex and std::map, " +
+                                    TO_S(LIMITER_ADDRESSES) + " addresses",
+                                    limiter, addresses);
+    }
+    return report.str();
+}
+
+class BenchRateLimiterApp : public WApplication {
+public:
+    BenchRateLimiterApp(const WEnvironment& env):
+        WApplication(env) {
+        new WText("Contention of RateLimiter ", root());
+        new WText("(internal check)", root());
+        new WText("<pre>" + limiter_bench_report() + "</pre>", root());
+    }
+};
+
+WApplication* createBenchRateLimiterApp(const WEnvironment& env) {
+    return new BenchRateLimiterApp(env);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && std::string(argv[1]) == "--bench") {
+        std::cout << limiter_bench_report();
+        return 0;
+    }
+    return WRun(argc, argv, &createBenchRateLimiterApp);
+}
+
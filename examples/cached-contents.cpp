@@ -12,6 +12,7 @@
 #include <Wt/WText>
 #include <Wt/WBreak>
 #include <Wt/WAnchor>
+#include <Wt/WDateTime>
 #include <Wt/Wc/CachedContents.hpp>
 #include <Wt/Wc/TimeDuration.hpp>
 #include <Wt/Wc/Url.hpp>
@@ -41,6 +42,13 @@ public:
         anchor("/ignored-1", "Non-cached complex job");
         anchor("/ignored-2", "Root for non-cached complex job 2");
         anchor("/ignored-2/ignored-3", "Non-cached complex job 2");
+        root()->addWidget(new WText("HTML of the following pages is shared "
+                                    "by non-Ajax sessions (requires "
+                                    "cookie session tracking)"));
+        root()->addWidget(new WBreak);
+        for (int i = 0; i < 3; i++) {
+            anchor("/shared/" + TO_S(i), "Shared complex job " + TO_S(i));
+        }
     }
 
     void anchor(std::string url, WString text) {
@@ -63,6 +71,8 @@ public:
     PredefinedNode* ignored_node;
     PredefinedNode* ignored_tree;
     PredefinedNode* ignored_node_2;
+    PredefinedNode* shared_root;
+    IntegerNode* shared_node;
 
     MyParser(WObject* parent):
         Parser(parent) {
@@ -71,6 +81,8 @@ public:
         ignored_node = new PredefinedNode("ignored-1", this);
         ignored_tree = new PredefinedNode("ignored-2", this);
         ignored_node_2 = new PredefinedNode("ignored-3", ignored_tree);
+        shared_root = new PredefinedNode("shared", this);
+        shared_node = new IntegerNode(shared_root);
     }
 };
 
@@ -81,6 +93,7 @@ public:
         set_cache_size(3);
         ignore_url("/ignored-1");
         ignore_prefix("/ignored-2");
+        set_html_cacheable("/shared/");
     }
 
     void show_complex_root() {
@@ -113,6 +126,15 @@ public:
         wApp->setTitle("This sub-URL is not cached");
     }
 
+    void show_shared(int id) {
+        boost::this_thread::sleep(SECOND); // work
+        // other sessions show the same time
+        WString time = WDateTime::currentDateTime().toString();
+        set_contents_raw(new WText("Shared " + TO_S(id) + ", rendered at " +
+                                   time.toUTF8()));
+        wApp->setTitle("Shared " + TO_S(id));
+    }
+
 protected:
     void open_url_impl(const std::string& url) {
         CachedApp::instance()->parser->open(url);
@@ -125,6 +147,12 @@ void show_complex_node() {
     app->main_widget->show_complex(id);
 }
 
+void show_shared_node() {
+    CachedApp* app = CachedApp::instance();
+    int id = app->parser->shared_node->integer();
+    app->main_widget->show_shared(id);
+}
+
 WApplication* createCachedApp(const WEnvironment& env) {
     CachedApp* app = new CachedApp(env);
     app->parser = new MyParser(app);
@@ -136,6 +164,7 @@ WApplication* createCachedApp(const WEnvironment& env) {
     p->ignored_node->opened().connect(m, &MainWidget::show_ignored_node);
     p->ignored_tree->opened().connect(m, &MainWidget::show_ignored_prefix);
     p->ignored_node_2->opened().connect(m, &MainWidget::show_ignored_node_2);
+    p->shared_node->opened().connect(boost::bind(show_shared_node));
     app->internalPathChanged().connect(m, &CachedContents::open_url);
     m->open_url(app->internalPath());
     return app;
@@ -50,6 +50,15 @@ check_cxx_source_compiles("#include <Wt/WTableView>\n int main() {
     Wt::WTableView v; v.setCurrentPage(0); }" WC_HAVE_ITEMVIEW_PAGING)
 check_cxx_source_compiles("#include <string>\n #include <Wt/WApplication>\n
     int main() { std::string l = wApp->locale(); }" WC_HAVE_STRING_LOCALE)
+check_cxx_source_compiles("#include <sstream>\n #include <Wt/WContainerWidget>\n
+    int main() { std::stringstream s; Wt::WContainerWidget c; c.htmlText(s); }"
+    WC_HAVE_WWIDGET_HTMLTEXT)
+check_cxx_source_compiles("#include <Wt/Http/Response>\n
+    #include <Wt/Http/ResponseContinuation>\n int main() {
+    Wt::Http::Response* r; r->createContinuation()->waitForMoreData(); }"
+    WC_HAVE_RESPONSE_CONTINUATION)
+check_cxx_source_compiles("#include <Wt/Utils>\n int main() {
+    Wt::Utils::base64Encode(\"\", false); }" WC_HAVE_WT_BASE64)
 
 if(WC_HAVE_WT_MD5)
     set(WC_HAVE_MD5 ON)
@@ -63,3 +72,10 @@ set(WC_HAVE_GRAVATAR ${WC_HAVE_MD5})
 set(WC_HAVE_RECAPTCHA ${WC_HAVE_WHTTP_MESSAGE})
 set(WC_HAVE_PAGER ${WC_HAVE_ITEMVIEW_PAGING})
 
+if(WC_HAVE_WHTTP_MESSAGE AND WC_HAVE_RESPONSE_CONTINUATION)
+    set(WC_HAVE_TILE_RESOURCE ON)
+endif()
+if(WC_HAVE_TILE_RESOURCE AND WC_HAVE_WRASTERIMAGE AND WC_HAVE_WT_BASE64)
+    set(WC_HAVE_TILE_VIEWPORT ON)
+endif()
+
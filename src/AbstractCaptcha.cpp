@@ -5,17 +5,10 @@
  * See the LICENSE file for terms of use.
  */
 
-#include <map>
-#include "boost-xtime.hpp"
-#include <boost/thread/mutex.hpp>
-
-#include <Wt/WDateTime>
-#include <Wt/WApplication>
-#include <Wt/WEnvironment>
+#include <boost/thread/once.hpp>
 
 #include "AbstractCaptcha.hpp"
-#include "TimeDuration.hpp"
-#include "util.hpp"
+#include "RateLimiter.hpp"
 
 namespace Wt {
 
@@ -66,42 +59,25 @@ void AbstractCaptcha::set_buttons(bool)
 void AbstractCaptcha::set_input(WFormWidget* /* input */)
 { }
 
-namespace frequency_check_namespace {
+static RateLimiter* default_frequency_limiter = 0;
+static boost::once_flag frequency_limiter_once = BOOST_ONCE_INIT;
 
-boost::mutex mutex;
-typedef std::map<std::string, WDateTime> Map;
-Map ip2last;
-int calls = 0;
-const int FILTER_EVERY = 1000;
-const td::TimeDuration INTERVAL = 3 * td::SECOND;
+static void create_frequency_limiter() {
+    // 1 attempt per 3 seconds
+    static RateLimiter limiter(1.0 / 3, 1.0);
+    default_frequency_limiter = &limiter;
+}
 
+RateLimiter& AbstractCaptcha::frequency_limiter() {
+    boost::call_once(frequency_limiter_once, create_frequency_limiter);
+    return *default_frequency_limiter;
 }
 
 WString AbstractCaptcha::frequency_check() {
-    using namespace frequency_check_namespace;
-    boost::mutex::scoped_lock lock(mutex);
-    WString result;
-    const std::string ip = wApp->environment().clientAddress();
-    Map::iterator it = ip2last.find(ip);
-    if (it != ip2last.end()) {
-        if (it->second + INTERVAL > now()) {
-            result = tr("wc.captcha.Too_often");
-        }
-    }
-    ip2last[ip] = now();
-    calls += 1;
-    if (calls >= FILTER_EVERY) {
-        calls = 0;
-        Map::iterator i = ip2last.begin();
-        while (i != ip2last.end()) {
-            if (i->second  + INTERVAL < now()) {
-                ip2last.erase(i++);
-            } else {
-                ++i;
-            }
-        }
+    if (!frequency_limiter().allow_client()) {
+        return tr("wc.captcha.Too_often");
     }
-    return result;
+    return WString::Empty;
 }
 
 void AbstractCaptcha::solve() {
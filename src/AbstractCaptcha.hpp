@@ -14,6 +14,8 @@
 #include <Wt/WCompositeWidget>
 #include <Wt/WSignal>
 
+#include "global.hpp"
+
 namespace Wt {
 
 namespace Wc {
@@ -99,16 +101,23 @@ public:
     }
 
     /** Attempts frequency controlling function.
-    Return error message, if last call from this IP address
-    was not later than 3 seconds ago, else empty string.
+    Return error message, if frequency of calls from this IP address
+    (IPv6 network /64) exceeds 1 per 3 seconds, else empty string.
 
     You can use this function by set_precheck() to prevent
     distributed brute-force attacks.
 
     This function is thread-safe.
+
+    \see frequency_limiter()
     */
     static WString frequency_check();
 
+    /** Return rate limiter used by frequency_check().
+    It can be reconfigured before the first check.
+    */
+    static RateLimiter& frequency_limiter();
+
 protected:
     /** Update the widget with new secret key (implementation).
     This method should setImplementation(), or update existing one.
@@ -5,71 +5,218 @@
  * See the LICENSE file for terms of use.
  */
 
+#include "config.hpp"
+
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <utility>
+#include <set>
+#include <vector>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
 #include <boost/assert.hpp>
-#include <boost/algorithm/string/predicate.hpp>
 
 #include <Wt/WApplication>
 #include <Wt/WEnvironment>
+#include <Wt/WText>
 
 #include "CachedContents.hpp"
+#include "HtmlCache.hpp"
+#include "util.hpp"
 
 namespace Wt {
 
 namespace Wc {
 
+struct CachedContents::Entry {
+    std::string url;
+    WWidget* widget;
+    WString title;
+    Entry* prev;
+    Entry* next;
+    // memory budget
+    CachedContents* owner;
+    size_t size;
+    Entry* global_prev;
+    Entry* global_next;
+    bool in_global; // false if not tracked or marked for eviction
+    bool evicting; // marked for eviction by other session
+};
+
+// LRU list of entries of all instances, used for memory budget
+struct GlobalCache {
+    typedef CachedContents::Entry Entry;
+    boost::mutex mutex;
+    Entry* first;
+    Entry* last;
+    size_t used;
+    size_t budget;
+
+    GlobalCache():
+        first(0), last(0), used(0), budget(0)
+    { }
+
+    void append(Entry* entry) {
+        entry->global_prev = last;
+        entry->global_next = 0;
+        if (last) {
+            last->global_next = entry;
+        } else {
+            first = entry;
+        }
+        last = entry;
+        entry->in_global = true;
+        used += entry->size;
+    }
+
+    void remove(Entry* entry) {
+        if (!entry->in_global) {
+            return;
+        }
+        if (entry->global_prev) {
+            entry->global_prev->global_next = entry->global_next;
+        } else {
+            first = entry->global_next;
+        }
+        if (entry->global_next) {
+            entry->global_next->global_prev = entry->global_prev;
+        } else {
+            last = entry->global_prev;
+        }
+        entry->global_prev = entry->global_next = 0;
+        entry->in_global = false;
+        used -= entry->size;
+    }
+};
+
+static GlobalCache global_cache;
+
+// node of trie of ignored prefixes
+struct CachedContents::PrefixNode {
+    typedef std::map<char, PrefixNode*> Children;
+    Children children;
+    bool is_prefix;
+
+    PrefixNode():
+        is_prefix(false)
+    { }
+
+    ~PrefixNode() {
+        BOOST_FOREACH (Children::value_type& c, children) {
+            delete c.second;
+        }
+    }
+};
+
 CachedContents::CachedContents(WContainerWidget* parent):
-    WContainerWidget(parent), cache_size_(10), current_widget_(0),
-    cache_title_(true)
-{ }
+    WContainerWidget(parent), ignored_prefixes_(new PrefixNode),
+    lru_first_(0), lru_last_(0), current_entry_(0),
+    cache_size_(10), current_widget_(0), cache_title_(true),
+    hits_(0), misses_(0), evictions_(0), cached_bytes_(0),
+    prefetching_(false), prefetched_widget_(0), prefetches_(0),
+    learn_transitions_(false), prefetch_count_(1),
+    html_cacheable_(new PrefixNode), html_ttl_(5 * td::MINUTE),
+    alive_(new int(0)) {
+    boost::weak_ptr<int> alive = alive_;
+    evict_marked_ = bound_post(boost::bind(&CachedContents::evict_marked_of,
+                                           alive, this));
+    prefetch_next_ = bound_post(boost::bind(
+                                    &CachedContents::prefetch_next_of,
+                                    alive, this));
+}
 
 CachedContents::~CachedContents() {
+    alive_.reset();
     clear_cache();
+    delete ignored_prefixes_;
+    delete html_cacheable_;
 }
 
 void CachedContents::open_url(const std::string& url) {
     std::string fixed_url = (!url.empty() && *url.rbegin() == '/') ?
                             url : url + "/";
-    if (is_ignored(fixed_url)) {
+    if (open_html_cached(fixed_url)) {
+        // shared HTML is used
+    } else if (is_ignored(fixed_url)) {
         open_url_impl(fixed_url);
     } else {
-        Url2Widget::iterator it = url_to_widget_.find(fixed_url);
-        if (it == url_to_widget_.end()) {
+        Url2Entry::iterator it = url_to_entry_.find(fixed_url);
+        if (it == url_to_entry_.end()) {
             open_url_impl(fixed_url);
-            WidgetAndTitle& widget_and_title = url_to_widget_[fixed_url];
-            widget_and_title.first = current_widget_;
-            if (cache_title_) {
-                widget_and_title.second = wApp->title();
+            if (current_widget_ && !current_entry_) {
+                Widget2Entry::iterator w = widget_to_entry_.find(
+                                               current_widget_);
+                if (w != widget_to_entry_.end()) {
+                    // cached for other URL
+                    current_entry_ = w->second;
+                } else {
+                    misses_ += 1;
+                    WString title = cache_title_ ? wApp->title() : WString();
+                    current_entry_ = add_entry(fixed_url, current_widget_,
+                                               title);
+                    resize_cache();
+                }
             }
-            visited_urls_.push_back(fixed_url);
-            resize_cache();
         } else {
-            WidgetAndTitle& widget_and_title = it->second;
-            WWidget* widget = widget_and_title.first;
-            set_contents_raw(widget);
+            Entry* entry = it->second;
+            hits_ += 1;
+            set_contents_raw(entry->widget);
+            current_entry_ = entry;
             if (cache_title_) {
-                const WString& title = widget_and_title.second;
-                wApp->setTitle(title);
+                wApp->setTitle(entry->title);
             }
-            visited_urls_.remove(fixed_url); // O(cache_size)
-            visited_urls_.push_back(fixed_url);
+            lru_remove(entry);
+            lru_append(entry);
         }
     }
+    if (learn_transitions_) {
+        learn_transition(fixed_url);
+    }
+}
+
+CachedContents::Entry* CachedContents::add_entry(const std::string& url,
+        WWidget* widget, const WString& title) {
+    Entry* entry = new Entry;
+    entry->url = url;
+    entry->widget = widget;
+    entry->title = title;
+    entry->owner = this;
+    entry->evicting = false;
+    entry->in_global = false;
+    entry->size = 0;
+    if (size_estimator_) {
+        entry->size = size_estimator_(widget);
+    } else if (memory_budget()) {
+        entry->size = default_size_estimator(widget);
+    }
+    cached_bytes_ += entry->size;
+    url_to_entry_[url] = entry;
+    widget_to_entry_[widget] = entry;
+    lru_append(entry);
+    return entry;
 }
 
 void CachedContents::set_contents_raw(WWidget* w) {
-    if (current_widget_) {
-        bool current_is_cached = false;
-        BOOST_FOREACH (const Url2Widget::value_type& u2w, url_to_widget_) {
-            // O(cache_size)
-            const WidgetAndTitle& w_a_t = u2w.second;
-            WWidget* widget = w_a_t.first;
-            if (widget == current_widget_) {
-                current_is_cached = true;
-                break;
-            }
+    if (prefetching_) {
+        // do not show prefetched widget
+        if (w == current_widget_) {
+            return;
+        }
+        if (prefetched_widget_ && prefetched_widget_ != w) {
+            delete prefetched_widget_;
+        }
+        prefetched_widget_ = w;
+        if (!w->parent()) {
+            addWidget(w);
         }
-        if (!current_is_cached) {
+        w->hide();
+        return;
+    }
+    if (current_widget_) {
+        if (!current_entry_) {
             // it is ignored or set by external code
             delete current_widget_;
             current_widget_ = 0;
@@ -91,6 +238,8 @@ void CachedContents::set_contents_raw(WWidget* w) {
         addWidget(w);
     }
     current_widget_ = w;
+    // open_url() sets it, if w is cached
+    current_entry_ = 0;
 }
 
 void CachedContents::set_cache_size(int cache_size) {
@@ -105,7 +254,11 @@ void CachedContents::ignore_url(const std::string& url) {
 }
 
 void CachedContents::ignore_prefix(const std::string& prefix) {
-    ignored_prefixes_.insert(prefix);
+    add_prefix(ignored_prefixes_, prefix);
+}
+
+void CachedContents::set_html_cacheable(const std::string& prefix) {
+    add_prefix(html_cacheable_, prefix);
 }
 
 void CachedContents::clear() {
@@ -114,18 +267,130 @@ void CachedContents::clear() {
 }
 
 void CachedContents::clear_cache() {
-    BOOST_FOREACH (Url2Widget::value_type& u2w, url_to_widget_) {
-        WidgetAndTitle& widget_and_title = u2w.second;
-        WWidget* widget = widget_and_title.first;
-        delete widget;
+    {
+        boost::mutex::scoped_lock lock(global_cache.mutex);
+        for (Entry* entry = lru_first_; entry; entry = entry->next) {
+            global_cache.remove(entry);
+        }
     }
-    url_to_widget_.clear();
-    visited_urls_.clear();
+    while (lru_first_) {
+        Entry* entry = lru_first_;
+        lru_remove(entry);
+        delete entry->widget;
+        delete entry;
+    }
+    cached_bytes_ = 0;
+    url_to_entry_.clear();
+    widget_to_entry_.clear();
+    prefetch_queue_.clear();
+    current_entry_ = 0;
     current_widget_ = 0;
 }
 
 void CachedContents::remove_from_cache(const std::string& url) {
-    url_to_widget_.erase(url);
+    Url2Entry::iterator it = url_to_entry_.find(url);
+    if (it != url_to_entry_.end()) {
+        remove_entry(it->second);
+    }
+}
+
+void CachedContents::reset_stats() {
+    hits_ = 0;
+    misses_ = 0;
+    evictions_ = 0;
+    prefetches_ = 0;
+}
+
+void CachedContents::prefetch(const std::string& url) {
+    const size_t MAX_QUEUE = 16;
+    std::string fixed_url = (!url.empty() && *url.rbegin() == '/') ?
+                            url : url + "/";
+    if (prefetch_queue_.size() >= MAX_QUEUE ||
+            url_to_entry_.find(fixed_url) != url_to_entry_.end() ||
+            std::find(prefetch_queue_.begin(), prefetch_queue_.end(),
+                      fixed_url) != prefetch_queue_.end()) {
+        return;
+    }
+    prefetch_queue_.push_back(fixed_url);
+    if (prefetch_queue_.size() == 1) {
+        prefetch_next_();
+    }
+}
+
+void CachedContents::prefetch_next_of(const boost::weak_ptr<int>& alive,
+                                      CachedContents* contents) {
+    // the address of deleted object can be reused by other object
+    if (alive.expired()) {
+        return; // already deleted
+    }
+    contents->prefetch_next();
+}
+
+void CachedContents::prefetch_next() {
+    if (prefetch_queue_.empty()) {
+        return;
+    }
+    std::string url = prefetch_queue_.front();
+    prefetch_queue_.pop_front();
+    size_t budget = memory_budget();
+    bool has_room = cached_count() < cache_size() &&
+                    (!budget || memory_used() < budget);
+    if (has_room && wApp->environment().ajax() && !is_ignored(url) &&
+            url_to_entry_.find(url) == url_to_entry_.end()) {
+        WString title = wApp->title();
+        prefetching_ = true;
+        prefetched_widget_ = 0;
+        open_url_impl(url);
+        prefetching_ = false;
+        WWidget* widget = prefetched_widget_;
+        prefetched_widget_ = 0;
+        WString prefetched_title = wApp->title();
+        wApp->setTitle(title);
+        if (widget && widget_to_entry_.find(widget) == widget_to_entry_.end()) {
+            add_entry(url, widget,
+                      cache_title_ ? prefetched_title : WString());
+            prefetches_ += 1;
+        }
+    }
+    if (!prefetch_queue_.empty()) {
+        prefetch_next_();
+    }
+}
+
+void CachedContents::learn_transition(const std::string& url) {
+    const size_t MAX_NEXT_URLS = 8;
+    if (!previous_url_.empty() && previous_url_ != url) {
+        Counts& counts = transitions_[previous_url_];
+        Counts::iterator it = counts.find(url);
+        if (it != counts.end()) {
+            it->second += 1;
+        } else {
+            if (counts.size() >= MAX_NEXT_URLS) {
+                // forget least frequent next URL
+                Counts::iterator min = counts.begin();
+                for (it = counts.begin(); it != counts.end(); ++it) {
+                    if (it->second < min->second) {
+                        min = it;
+                    }
+                }
+                counts.erase(min);
+            }
+            counts[url] = 1;
+        }
+    }
+    previous_url_ = url;
+    Transitions::const_iterator t = transitions_.find(url);
+    if (t == transitions_.end()) {
+        return;
+    }
+    std::vector<std::pair<int, std::string> > next_urls;
+    BOOST_FOREACH (const Counts::value_type& c, t->second) {
+        next_urls.push_back(std::make_pair(-c.second, c.first));
+    }
+    std::sort(next_urls.begin(), next_urls.end());
+    for (int i = 0; i < prefetch_count_ && i < int(next_urls.size()); ++i) {
+        prefetch(next_urls[i].second);
+    }
 }
 
 void CachedContents::resize_cache() {
@@ -133,34 +398,232 @@ void CachedContents::resize_cache() {
     if (desired_size < 0) {
         desired_size = 0;
     }
-    while (visited_urls_.size() > desired_size) {
-        const std::string& url = visited_urls_.front();
-        Url2Widget::iterator it = url_to_widget_.find(url);
-        BOOST_ASSERT(it != url_to_widget_.end());
-        WidgetAndTitle& widget_and_title = it->second;
-        WWidget* widget = widget_and_title.first;
-        if (widget != current_widget_) {
-            delete widget;
+    while (cached_count() > desired_size) {
+        BOOST_ASSERT(lru_first_);
+        remove_entry(lru_first_);
+        evictions_ += 1;
+    }
+}
+
+size_t CachedContents::default_size_estimator(WWidget* widget) {
+    const size_t OBJECT_SIZE = 1024;
+    size_t objects = 0;
+    std::vector<const WObject*> stack;
+    stack.push_back(widget);
+    while (!stack.empty()) {
+        const WObject* o = stack.back();
+        stack.pop_back();
+        objects += 1;
+        BOOST_FOREACH (const WObject* child, o->children()) {
+            stack.push_back(child);
+        }
+    }
+    return objects * OBJECT_SIZE;
+}
+
+void CachedContents::set_memory_budget(size_t bytes) {
+    boost::mutex::scoped_lock lock(global_cache.mutex);
+    global_cache.budget = bytes;
+}
+
+size_t CachedContents::memory_budget() {
+    boost::mutex::scoped_lock lock(global_cache.mutex);
+    return global_cache.budget;
+}
+
+size_t CachedContents::memory_used() {
+    boost::mutex::scoped_lock lock(global_cache.mutex);
+    return global_cache.used;
+}
+
+void CachedContents::evict_marked_of(const boost::weak_ptr<int>& alive,
+                                     CachedContents* contents) {
+    // the address of deleted object can be reused by other object
+    if (alive.expired()) {
+        return; // already deleted
+    }
+    // we are in the session of contents, so it can not be deleted now
+    contents->evict_marked();
+}
+
+void CachedContents::evict_marked() {
+    std::vector<Entry*> victims;
+    {
+        // flags are set by other sessions
+        boost::mutex::scoped_lock lock(global_cache.mutex);
+        for (Entry* entry = lru_first_; entry; entry = entry->next) {
+            if (entry->evicting) {
+                victims.push_back(entry);
+            }
+        }
+    }
+    BOOST_FOREACH (Entry* entry, victims) {
+        remove_entry(entry);
+        evictions_ += 1;
+    }
+}
+
+// also moves the entry to the end of global LRU and applies memory budget
+void CachedContents::lru_append(Entry* entry) {
+    bool has_own_victims = false;
+    std::set<CachedContents*> owners;
+    std::vector<boost::function<void()> > posts;
+    {
+        boost::mutex::scoped_lock lock(global_cache.mutex);
+        global_cache.remove(entry);
+        // entry is used again, so it is not evicted
+        entry->evicting = false;
+        global_cache.append(entry);
+        if (global_cache.budget) {
+            Entry* victim = global_cache.first;
+            while (global_cache.used > global_cache.budget && victim) {
+                Entry* next = victim->global_next;
+                if (victim != entry) {
+                    global_cache.remove(victim);
+                    victim->evicting = true;
+                    if (victim->owner == this) {
+                        has_own_victims = true;
+                    } else {
+                        owners.insert(victim->owner);
+                    }
+                }
+                victim = next;
+            }
+            BOOST_FOREACH (CachedContents* owner, owners) {
+                posts.push_back(owner->evict_marked_);
+            }
         }
-        url_to_widget_.erase(it);
-        visited_urls_.pop_front();
     }
+    BOOST_FOREACH (const boost::function<void()>& post, posts) {
+        post();
+    }
+    if (has_own_victims) {
+        evict_marked();
+    }
+    entry->prev = lru_last_;
+    entry->next = 0;
+    if (lru_last_) {
+        lru_last_->next = entry;
+    } else {
+        lru_first_ = entry;
+    }
+    lru_last_ = entry;
 }
 
-bool CachedContents::is_ignored(const std::string& url) {
+void CachedContents::lru_remove(Entry* entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        lru_first_ = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        lru_last_ = entry->prev;
+    }
+    entry->prev = entry->next = 0;
+}
+
+void CachedContents::remove_entry(Entry* entry) {
+    lru_remove(entry);
+    {
+        boost::mutex::scoped_lock lock(global_cache.mutex);
+        global_cache.remove(entry);
+    }
+    cached_bytes_ -= entry->size;
+    url_to_entry_.erase(entry->url);
+    widget_to_entry_.erase(entry->widget);
+    if (entry == current_entry_) {
+        // current widget is deleted by next set_contents_raw()
+        current_entry_ = 0;
+    } else {
+        delete entry->widget;
+    }
+    delete entry;
+}
+
+bool CachedContents::is_ignored(const std::string& url) const {
     if (ignored_urls_.find(url) != ignored_urls_.end()) {
         return true;
     }
-    if (!ignored_prefixes_.empty()) {
-        StringsSet::const_iterator it = ignored_prefixes_.upper_bound(url);
-        if (it != ignored_prefixes_.begin()) {
-            it--;
-            const std::string& prefix = *it;
-            if (boost::starts_with(url, prefix)) {
-                return true;
+    return has_prefix(ignored_prefixes_, url);
+}
+
+#ifdef WC_HAVE_WWIDGET_HTMLTEXT
+// URL session tracking: URLs of the session contain its id
+static bool session_id_in_urls() {
+    return wApp->url().find(wApp->sessionId()) != std::string::npos;
+}
+
+// HTML containing URLs of the session must not be shown to other clients
+static bool is_shareable(const std::string& html) {
+    return html.find(wApp->sessionId()) == std::string::npos &&
+           html.find("request=resource") == std::string::npos;
+}
+
+bool CachedContents::open_html_cached(const std::string& url) {
+    if (wApp->environment().ajax() || !has_prefix(html_cacheable_, url) ||
+            session_id_in_urls()) {
+        return false;
+    }
+    HtmlCache& cache = HtmlCache::instance();
+    std::string locale = get_locale();
+    std::string html, title;
+    if (cache.get(url, locale, html_variant_, html, title)) {
+        hits_ += 1;
+        set_contents_raw(new WText(WString::fromUTF8(html), XHTMLUnsafeText));
+        if (cache_title_) {
+            wApp->setTitle(WString::fromUTF8(title));
+        }
+    } else {
+        open_url_impl(url);
+        if (current_widget_) {
+            // the widget is not cached in the session
+            std::stringstream stream;
+            current_widget_->htmlText(stream);
+            if (is_shareable(stream.str())) {
+                misses_ += 1;
+                cache.put(url, locale, html_variant_, stream.str(),
+                          wApp->title().toUTF8(), html_ttl_);
             }
         }
     }
+    return true;
+}
+#else
+bool CachedContents::open_html_cached(const std::string&) {
+    return false;
+}
+#endif
+
+void CachedContents::add_prefix(PrefixNode* root, const std::string& prefix) {
+    PrefixNode* node = root;
+    BOOST_FOREACH (char c, prefix) {
+        PrefixNode*& child = node->children[c];
+        if (!child) {
+            child = new PrefixNode;
+        }
+        node = child;
+    }
+    node->is_prefix = true;
+}
+
+bool CachedContents::has_prefix(const PrefixNode* root,
+                                const std::string& url) {
+    const PrefixNode* node = root;
+    if (node->is_prefix) {
+        return true;
+    }
+    BOOST_FOREACH (char c, url) {
+        PrefixNode::Children::const_iterator it = node->children.find(c);
+        if (it == node->children.end()) {
+            return false;
+        }
+        node = it->second;
+        if (node->is_prefix) {
+            return true;
+        }
+    }
     return false;
 }
 
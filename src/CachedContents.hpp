@@ -8,13 +8,19 @@
 #ifndef WC_CACHED_CONTENTS_HPP_
 #define WC_CACHED_CONTENTS_HPP_
 
-#include <set>
-#include <map>
 #include <string>
-#include <utility>
+#include <deque>
+#include <map>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 
 #include <Wt/WContainerWidget>
 
+#include "TimeDuration.hpp"
+
 namespace Wt {
 
 namespace Wc {
@@ -58,8 +64,10 @@ public:
     If the URL is not ignored according to rules set by ignore_url()
     of ignore_prefix(), the widget is cached and is used if the URL
     is opened next time.
-    If cache_size() is exceeded, the earliest widget is deleted.
-    most unpopular widgets are deleted.
+    If cache_size() is exceeded, least recently used widgets are deleted.
+
+    Lookup of the URL and update of the order of use take O(1) time,
+    checking of ignore rules takes O(length of URL) time.
     */
     void open_url(const std::string& url);
 
@@ -113,6 +121,173 @@ public:
     /** Remove cached widget with this URL */
     void remove_from_cache(const std::string& url);
 
+    /** Return number of widgets in cache (including currently shown) */
+    int cached_count() const {
+        return url_to_entry_.size();
+    }
+
+    /** Return number of URLs opened from cache */
+    long long hits() const {
+        return hits_;
+    }
+
+    /** Return number of URLs passed to open_url_impl() and then cached */
+    long long misses() const {
+        return misses_;
+    }
+
+    /** Return number of widgets deleted because of cache_size() limit */
+    long long evictions() const {
+        return evictions_;
+    }
+
+    /** Reset hits(), misses(), evictions() and prefetches() to 0 */
+    void reset_stats();
+
+    /** Function returning estimated memory size of cached widget (bytes) */
+    typedef boost::function<size_t(WWidget*)> SizeEstimator;
+
+    /** Set function estimating memory size of cached widgets.
+    If it is not set, default_size_estimator() is used
+    (only if memory_budget() is set).
+    The estimator is called once, when the widget is added to the cache.
+    */
+    void set_size_estimator(const SizeEstimator& estimator) {
+        size_estimator_ = estimator;
+    }
+
+    /** Default estimator of widget size.
+    Returns number of objects in the tree of the widget multiplied by 1024.
+    */
+    static size_t default_size_estimator(WWidget* widget);
+
+    /** Return estimated size of widgets cached by this instance (bytes) */
+    size_t cached_bytes() const {
+        return cached_bytes_;
+    }
+
+    /** Set process-wide memory budget of all CachedContents (bytes).
+    If estimated size of all cached widgets exceeds the budget,
+    globally least recently used widgets are deleted
+    (including widgets of other sessions).
+    Widgets of other sessions are deleted inside their sessions
+    (see bound_post()), so memory is freed with some delay.
+
+    Defaults to 0 (no budget).
+    */
+    static void set_memory_budget(size_t bytes);
+
+    /** Return process-wide memory budget of all CachedContents (bytes) */
+    static size_t memory_budget();
+
+    /** Return estimated size of widgets cached by all CachedContents */
+    static size_t memory_used();
+
+    /** Build and cache the widget for the URL in idle time.
+    The URL is added to the queue of prefetched URLs.
+    The queue is processed after the current request is handled
+    (see bound_post()), one URL per event, so the user
+    does not wait for prefetching.
+
+    The URL is prefetched only if it is not cached yet, is not ignored,
+    the cache has room for it (cached_count() < cache_size() and
+    memory_used() < memory_budget(), if the budget is set)
+    and the session uses Ajax (in HTML version cached widgets are not
+    kept in the browser).
+
+    open_url_impl() is called for the URL; the widget passed to
+    set_contents_raw() is cached (hidden) instead of being shown.
+    Title, set by open_url_impl(), is cached and then restored.
+
+    \attention open_url_impl() should not have side effects other than
+        set_contents_raw() and setting of title for prefetching to work.
+    */
+    void prefetch(const std::string& url);
+
+    /** Return if transitions between URLs are learned.
+    Defaults to false.
+    */
+    bool learn_transitions() const {
+        return learn_transitions_;
+    }
+
+    /** Set if transitions between URLs are learned.
+    If enabled, open_url() remembers how often each URL was
+    opened after the previous one and calls prefetch() for
+    prefetch_count() most frequent next URLs.
+    */
+    void set_learn_transitions(bool learn_transitions) {
+        learn_transitions_ = learn_transitions;
+    }
+
+    /** Return max number of URLs prefetched after open_url().
+    Defaults to 1.
+    */
+    int prefetch_count() const {
+        return prefetch_count_;
+    }
+
+    /** Set max number of URLs prefetched after open_url() */
+    void set_prefetch_count(int prefetch_count) {
+        prefetch_count_ = prefetch_count;
+    }
+
+    /** Return number of widgets built and cached by prefetch() */
+    long long prefetches() const {
+        return prefetches_;
+    }
+
+    /** Share rendered HTML of URLs starting with the prefix.
+    For HTML (non-Ajax) sessions, HTML of such URLs is rendered once
+    and stored in HtmlCache::instance(), keyed by URL, locale
+    and html_variant().
+    Other HTML sessions opening the URL get the stored HTML
+    (as WText with XHTMLUnsafeText) instead of calling open_url_impl().
+
+    Mark only anonymous pages with static contents (text, static images,
+    anchors), same for all users having the same locale and html_variant().
+    Form widgets and event handlers do not work in stored HTML.
+
+    Stored HTML must not contain URLs bound to the session.
+    So HTML is shared only if session tracking does not put the session
+    id into URLs (\c session-tracking is \c CookiesURL in wt_config.xml
+    and the browser accepts cookies).
+    HTML containing the session id or URLs of resources
+    (e.g., WImage with a WResource) is not stored.
+
+    \note This requires Wt 3.3.0 (WWidget::htmlText()),
+        otherwise this has no effect.
+    */
+    void set_html_cacheable(const std::string& prefix);
+
+    /** Return variant of HTML used as part of key in HtmlCache.
+    Defaults to empty string.
+    */
+    const std::string& html_variant() const {
+        return html_variant_;
+    }
+
+    /** Set variant of HTML used as part of key in HtmlCache */
+    void set_html_variant(const std::string& html_variant) {
+        html_variant_ = html_variant;
+    }
+
+    /** Return time for which rendered HTML is stored in HtmlCache.
+    Defaults to 5 minutes.
+    */
+    const td::TimeDuration& html_ttl() const {
+        return html_ttl_;
+    }
+
+    /** Set time for which rendered HTML is stored in HtmlCache */
+    void set_html_ttl(const td::TimeDuration& html_ttl) {
+        html_ttl_ = html_ttl;
+    }
+
+#ifndef DOXYGEN_ONLY
+    struct Entry;
+#endif
+
 protected:
     /** Update visible contents of widget according to the URL (implementation).
     The function is invoked from open_url() if this URL is not in cache.
@@ -121,20 +296,60 @@ protected:
     virtual void open_url_impl(const std::string& url) = 0;
 
 private:
-    typedef std::set<std::string> StringsSet;
+    struct PrefixNode;
+    typedef boost::unordered_set<std::string> StringsSet;
     StringsSet ignored_urls_;
-    StringsSet ignored_prefixes_;
-    typedef std::pair<WWidget*, WString> WidgetAndTitle;
-    typedef std::map<std::string, WidgetAndTitle> Url2Widget;
-    Url2Widget url_to_widget_;
-    typedef std::list<std::string> StringsList;
-    StringsList visited_urls_;
+    PrefixNode* ignored_prefixes_;
+    typedef boost::unordered_map<std::string, Entry*> Url2Entry;
+    Url2Entry url_to_entry_;
+    typedef boost::unordered_map<WWidget*, Entry*> Widget2Entry;
+    Widget2Entry widget_to_entry_;
+    Entry* lru_first_; // least recently used
+    Entry* lru_last_; // most recently used
+    Entry* current_entry_; // entry of current_widget_ or 0
     int cache_size_;
     WWidget* current_widget_;
     bool cache_title_;
+    long long hits_;
+    long long misses_;
+    long long evictions_;
+    SizeEstimator size_estimator_;
+    size_t cached_bytes_;
+    boost::function<void()> evict_marked_;
+    std::deque<std::string> prefetch_queue_;
+    boost::function<void()> prefetch_next_;
+    bool prefetching_;
+    WWidget* prefetched_widget_;
+    long long prefetches_;
+    bool learn_transitions_;
+    int prefetch_count_;
+    std::string previous_url_;
+    typedef std::map<std::string, int> Counts;
+    typedef boost::unordered_map<std::string, Counts> Transitions;
+    Transitions transitions_;
+    PrefixNode* html_cacheable_;
+    std::string html_variant_;
+    td::TimeDuration html_ttl_;
+    // expires with this object; checked by posted functions
+    boost::shared_ptr<int> alive_;
 
-    bool is_ignored(const std::string& url);
+    bool is_ignored(const std::string& url) const;
+    bool open_html_cached(const std::string& url);
+    static void add_prefix(PrefixNode* root, const std::string& prefix);
+    static bool has_prefix(const PrefixNode* root, const std::string& url);
+    void evict_marked();
+    static void evict_marked_of(const boost::weak_ptr<int>& alive,
+                                CachedContents* contents);
+    static void prefetch_next_of(const boost::weak_ptr<int>& alive,
+                                 CachedContents* contents);
+    void prefetch_next();
+    void learn_transition(const std::string& url);
+    Entry* add_entry(const std::string& url, WWidget* widget,
+                     const WString& title);
     void resize_cache();
+    void lru_append(Entry* entry);
+    void lru_remove(Entry* entry);
+    void remove_entry(Entry* entry);
 };
 
 }
@@ -0,0 +1,284 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <cstdlib>
+#include <map>
+#include <boost/foreach.hpp>
+#include <boost/thread/once.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <Wt/WConfig.h>
+
+#include "ConfigRegistry.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+struct ConfigRegistry::Property {
+    std::string value;
+    bool is_int;
+    int int_value;
+    bool is_bool;
+    bool bool_value;
+    bool is_duration;
+    td::TimeDuration duration;
+};
+
+struct ConfigRegistry::Snapshot {
+    typedef std::map<std::string, Property> Properties;
+    Properties properties;
+};
+
+static bool parse_bool(const std::string& value, bool& result) {
+    std::string v = boost::algorithm::to_lower_copy(value);
+    if (v == "true" || v == "yes" || v == "on" || v == "1") {
+        result = true;
+        return true;
+    } else if (v == "false" || v == "no" || v == "off" || v == "0") {
+        result = false;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_duration(const std::string& value,
+                           td::TimeDuration& result) {
+    using namespace boost::posix_time;
+    const char* first = value.data();
+    const char* last = first + value.size();
+    long long number;
+    const char* unit_begin = parse_integer(first, last, number);
+    if (unit_begin != first) {
+        std::string unit(unit_begin, last);
+        boost::algorithm::trim(unit);
+        if (unit == "ms") {
+            result = milliseconds(number);
+        } else if (unit.empty() || unit == "s") {
+            result = seconds(long(number));
+        } else if (unit == "min") {
+            result = minutes(long(number));
+        } else if (unit == "h") {
+            result = hours(long(number));
+        } else if (unit == "d") {
+            result = hours(long(number * 24));
+        } else if (unit[0] == ':') {
+            try {
+                result = duration_from_string(value);
+            } catch (...) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+static void read_properties(const boost::property_tree::ptree& settings,
+                            ConfigRegistry::Snapshot::Properties& properties) {
+    using boost::property_tree::ptree;
+    boost::optional<const ptree&> props = settings.get_child_optional(
+            "properties");
+    if (!props) {
+        return;
+    }
+    BOOST_FOREACH (const ptree::value_type& p, *props) {
+        if (p.first != "property") {
+            continue;
+        }
+        std::string name = p.second.get<std::string>("<xmlattr>.name", "");
+        if (name.empty()) {
+            continue;
+        }
+        ConfigRegistry::Property& property = properties[name];
+        property.value = boost::algorithm::trim_copy(p.second.data());
+        const std::string& v = property.value;
+        property.is_int = parse_integer(v, property.int_value);
+        property.is_bool = parse_bool(v, property.bool_value);
+        property.is_duration = parse_duration(v, property.duration);
+    }
+}
+
+ConfigRegistry::ConfigRegistry():
+    version_(0)
+{ }
+
+ConfigRegistry::~ConfigRegistry()
+{ }
+
+static ConfigRegistry* default_registry = 0;
+static boost::once_flag default_registry_once = BOOST_ONCE_INIT;
+
+static void create_default_registry() {
+    static ConfigRegistry registry;
+    default_registry = &registry;
+}
+
+ConfigRegistry& ConfigRegistry::instance() {
+    boost::call_once(default_registry_once, create_default_registry);
+    return *default_registry;
+}
+
+std::string ConfigRegistry::default_file() {
+    const char* env = std::getenv("WT_CONFIG_XML");
+    if (env) {
+        return env;
+    }
+#ifdef WT_CONFIG_XML
+    return WT_CONFIG_XML;
+#else
+    return "/etc/wt/wt_config.xml";
+#endif
+}
+
+bool ConfigRegistry::load(const std::string& filename,
+                          const std::string& location) {
+    using boost::property_tree::ptree;
+    std::string path = filename.empty() ? default_file() : filename;
+    boost::shared_ptr<Snapshot> snapshot(new Snapshot);
+    try {
+        ptree config;
+        boost::property_tree::read_xml(path, config);
+        const ptree& server = config.get_child("server");
+        // location "*" first, then overridden by the given location
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1 && location == "*") {
+                break;
+            }
+            const std::string& l = pass == 0 ? std::string("*") : location;
+            BOOST_FOREACH (const ptree::value_type& s, server) {
+                if (s.first == "application-settings" &&
+                        s.second.get<std::string>("<xmlattr>.location",
+                                                  "") == l) {
+                    read_properties(s.second, snapshot->properties);
+                }
+            }
+        }
+    } catch (...) {
+        return false;
+    }
+    std::vector<ReloadHandler> handlers;
+    // old snapshot is freed by its last thread or below, without locks
+    SnapshotPtr old = snapshot;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        filename_ = path;
+        location_ = location;
+        {
+            boost::mutex::scoped_lock current_lock(current_mutex_);
+            current_.swap(old);
+            ++version_;
+        }
+        handlers = handlers_;
+    }
+    old.reset();
+    BOOST_FOREACH (const ReloadHandler& handler, handlers) {
+        handler();
+    }
+    return true;
+}
+
+bool ConfigRegistry::reload() {
+    std::string filename, location;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (filename_.empty()) {
+            return false;
+        }
+        filename = filename_;
+        location = location_;
+    }
+    return load(filename, location);
+}
+
+bool ConfigRegistry::loaded() const {
+    return current().get() != 0;
+}
+
+void ConfigRegistry::add_reload_handler(const ReloadHandler& handler) {
+    boost::mutex::scoped_lock lock(mutex_);
+    handlers_.push_back(handler);
+}
+
+boost::shared_ptr<const std::string> ConfigRegistry::find(
+    const std::string& name) const {
+    const SnapshotPtr& snapshot = current();
+    const Property* property = find_property(snapshot, name);
+    if (!property) {
+        return boost::shared_ptr<const std::string>();
+    }
+    // shares ownership of the snapshot
+    return boost::shared_ptr<const std::string>(snapshot, &property->value);
+}
+
+std::string ConfigRegistry::get(const std::string& name,
+                                const std::string& def) const {
+    const SnapshotPtr& snapshot = current();
+    const Property* property = find_property(snapshot, name);
+    return property ? property->value : def;
+}
+
+int ConfigRegistry::get_int(const std::string& name, int def) const {
+    const SnapshotPtr& snapshot = current();
+    const Property* property = find_property(snapshot, name);
+    return (property && property->is_int) ? property->int_value : def;
+}
+
+bool ConfigRegistry::get_bool(const std::string& name, bool def) const {
+    const SnapshotPtr& snapshot = current();
+    const Property* property = find_property(snapshot, name);
+    return (property && property->is_bool) ? property->bool_value : def;
+}
+
+td::TimeDuration ConfigRegistry::get_duration(const std::string& name,
+        const td::TimeDuration& def) const {
+    const SnapshotPtr& snapshot = current();
+    const Property* property = find_property(snapshot, name);
+    return (property && property->is_duration) ? property->duration : def;
+}
+
+const ConfigRegistry::SnapshotPtr& ConfigRegistry::current() const {
+    // the result is valid until next call from this thread
+    ThreadCache* cache = cache_.get();
+#if WC_USE_BOOST_ATOMIC
+    if (cache && cache->version ==
+            version_.load(boost::memory_order_acquire)) {
+        return cache->snapshot;
+    }
+#endif
+    if (!cache) {
+        cache = new ThreadCache;
+        cache_.reset(cache);
+    }
+    boost::mutex::scoped_lock lock(current_mutex_);
+    unsigned version = version_;
+    if (cache->version != version) {
+        cache->snapshot = current_;
+        cache->version = version;
+    }
+    return cache->snapshot;
+}
+
+const ConfigRegistry::Property* ConfigRegistry::find_property(
+    const SnapshotPtr& snapshot, const std::string& name) {
+    if (!snapshot) {
+        return 0;
+    }
+    Snapshot::Properties::const_iterator it = snapshot->properties.find(name);
+    return it == snapshot->properties.end() ? 0 : &it->second;
+}
+
+}
+
+}
+
@@ -0,0 +1,179 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef WC_CONFIG_REGISTRY_HPP_
+#define WC_CONFIG_REGISTRY_HPP_
+
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "TimeDuration.hpp"
+#include "util.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+/** Cached typed configuration properties.
+
+All properties of wt_config.xml are parsed once by load().
+Reading of a property does not parse values and does not need wApp,
+so it can be used from any thread (e.g., from notify::Task::process()).
+
+Each thread keeps a pointer to properties it has read last time
+and the version of them.
+Reading of a property compares this version with the atomic version
+of the registry, changed by load(), and takes the lock only
+if properties were replaced.
+So reads do not lock a mutex and do not change reference counters.
+Properties replaced by reload() are freed when each thread,
+which has read them, reads a property again or exits.
+
+\note Without boost::atomic (see WC_USE_BOOST_ATOMIC in util.hpp)
+the version is compared under short lock.
+
+\code
+ConfigRegistry& config = ConfigRegistry::instance();
+config.load("/etc/wt/wt_config.xml");
+int limit = config.get_int("upload-limit", 100);
+td::TimeDuration timeout = config.get_duration("timeout", 10 * td::SECOND);
+\endcode
+
+Property values are converted to int, bool and duration once,
+when they are loaded:
+ - int: see parse_integer();
+ - bool: "true", "yes", "on", "1" or "false", "no", "off", "0";
+ - duration: integer followed by optional unit ("ms", "s", "min", "h", "d";
+   seconds by default) or "HH:MM:SS".
+
+Properties of application-settings with location "*" are read first,
+then they are overridden by properties of application-settings with
+the given location.
+
+Once loaded, instance() is used by config_value().
+
+\ingroup util
+*/
+class ConfigRegistry {
+public:
+    /** Function called after successful load() or reload() */
+    typedef boost::function<void()> ReloadHandler;
+
+    /** Constructor */
+    ConfigRegistry();
+
+    /** Destructor */
+    virtual ~ConfigRegistry();
+
+    /** Return default registry */
+    static ConfigRegistry& instance();
+
+    /** Return default path to wt_config.xml.
+    This is environment variable WT_CONFIG_XML,
+    or Wt's default configuration file.
+    */
+    static std::string default_file();
+
+    /** Read properties from the file.
+    \param filename Path to wt_config.xml (empty means default_file()).
+    \param location Location of application-settings to use.
+
+    On success, new properties replace old ones atomically
+    and reload handlers are called.
+    On failure, old properties are kept and false is returned.
+    */
+    bool load(const std::string& filename = "",
+              const std::string& location = "*");
+
+    /** Read properties again from the file, passed to last load() */
+    bool reload();
+
+    /** Return if properties were loaded */
+    bool loaded() const;
+
+    /** Add function to be called after successful load() or reload().
+    The function is called from the thread calling load().
+    */
+    void add_reload_handler(const ReloadHandler& handler);
+
+    /** Return pointer to value of the property or 0 if not found.
+    The value is not copied, the pointer keeps it alive after reload().
+    */
+    boost::shared_ptr<const std::string> find(const std::string& name) const;
+
+    /** Return value of the property or \p def if not found */
+    std::string get(const std::string& name,
+                    const std::string& def = "") const;
+
+    /** Return integer value of the property.
+    If not found or is not an integer, \p def is returned.
+    */
+    int get_int(const std::string& name, int def) const;
+
+    /** Return boolean value of the property.
+    If not found or is not a boolean, \p def is returned.
+    */
+    bool get_bool(const std::string& name, bool def) const;
+
+    /** Return duration value of the property.
+    If not found or is not a duration, \p def is returned.
+    */
+    td::TimeDuration get_duration(const std::string& name,
+                                  const td::TimeDuration& def) const;
+
+#ifndef DOXYGEN_ONLY
+    struct Property;
+    struct Snapshot;
+#endif
+
+private:
+    typedef boost::shared_ptr<const Snapshot> SnapshotPtr;
+
+    // snapshot, used by a thread
+    struct ThreadCache {
+        SnapshotPtr snapshot;
+        unsigned version;
+
+        ThreadCache():
+            version(0)
+        { }
+    };
+
+    // replaced by load(), threads hold copies
+    SnapshotPtr current_;
+    // incremented with replacement of current_, under current_mutex_
+#if WC_USE_BOOST_ATOMIC
+    boost::atomic<unsigned> version_;
+#else
+    unsigned version_;
+#endif
+    mutable boost::mutex current_mutex_;
+    mutable boost::thread_specific_ptr<ThreadCache> cache_;
+    std::vector<ReloadHandler> handlers_;
+    std::string filename_;
+    std::string location_;
+    boost::mutex mutex_;
+
+    const SnapshotPtr& current() const;
+    static const Property* find_property(const SnapshotPtr& snapshot,
+                                         const std::string& name);
+
+    ConfigRegistry(const ConfigRegistry&);
+    ConfigRegistry& operator=(const ConfigRegistry&);
+};
+
+}
+
+}
+
+#endif
+
@@ -5,6 +5,10 @@
  * See the LICENSE file for terms of use.
  */
 
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <boost/foreach.hpp>
+
 #include <Wt/WApplication>
 #include <Wt/WImage>
 #include <Wt/Http/Request>
@@ -22,11 +26,49 @@ EtagStoreResource::EtagStoreResource(const std::string& cookie_name,
                                      const std::string& send_header,
                                      const std::string& receive_header,
                                      WObject* parent):
-    WResource(parent), cookie_name_(cookie_name),
+    WResource(parent),
+    cookie_name_(cookie_name),
     send_header_(send_header), receive_header_(receive_header) {
     setDispositionType(WResource::Inline);
 }
 
+td::TimeDuration EtagStoreResource::idle_timeout() const {
+    Shard& shard = shards_[0];
+    boost::mutex::scoped_lock lock(shard.mutex);
+    return shard.idle_timeout;
+}
+
+void EtagStoreResource::set_idle_timeout(const td::TimeDuration& timeout) {
+    for (int i = 0; i < SHARDS_NUMBER; ++i) {
+        Shard& shard = shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        shard.idle_timeout = timeout;
+    }
+}
+
+EtagStoreResource::Shard::Shard():
+    first(0), last(0), idle_timeout(boost::posix_time::hours(24))
+{ }
+
+void EtagStoreResource::Shard::unlink(Etag* etag) {
+    (etag->prev ? etag->prev->next : first) = etag->next;
+    (etag->next ? etag->next->prev : last) = etag->prev;
+}
+
+void EtagStoreResource::Shard::append(Etag* etag) {
+    etag->prev = last;
+    etag->next = 0;
+    (last ? last->next : first) = etag;
+    last = etag;
+}
+
+void EtagStoreResource::Shard::touch(Etag* etag,
+                                     const boost::posix_time::ptime& now) {
+    unlink(etag);
+    append(etag);
+    etag->last_access = now;
+}
+
 static const char EMPTY_GIF[] = {
     0x47, 0x49, 0x46, 0x38, 0x39, 0x61, 0x01, 0x00, 0x01, 0x00,
     0x80, 0x00, 0x00, 0xdb, 0xdf, 0xef, 0x00, 0x00, 0x00, 0x21,
@@ -37,102 +79,290 @@ static const char EMPTY_GIF[] = {
 
 const int EMPTY_GIF_SIZE = 43;
 
+// header values are created once
+static const std::string CONTENT_LENGTH = "Content-Length";
+static const std::string EMPTY_GIF_SIZE_STR = "43";
+static const std::string COOKIE = "Cookie";
+
 void EtagStoreResource::handleRequest(const Http::Request& request,
                                       Http::Response& response) {
-    handle_etag(request, response);
+    bool not_modified = handle_etag(request, response);
+    if (not_modified) {
+        response.setStatus(304);
+        return;
+    }
     response.setMimeType("image/gif");
-    response.addHeader("Content-Length", TO_S(EMPTY_GIF_SIZE));
+    response.addHeader(CONTENT_LENGTH, EMPTY_GIF_SIZE_STR);
     response.out().write(EMPTY_GIF, EMPTY_GIF_SIZE);
 }
 
-void EtagStoreResource::handle_etag(const Http::Request& request,
+size_t EtagStoreResource::CookieHash::operator()(const std::string& s) const {
+    return boost::hash_range(s.begin(), s.end());
+}
+
+size_t EtagStoreResource::CookieHash::operator()(const StringRef& s) const {
+    return boost::hash_range(s.begin, s.end);
+}
+
+bool EtagStoreResource::CookieEqual::operator()(const StringRef& a,
+        const std::string& b) const {
+    size_t size = a.end - a.begin;
+    return size == b.size() && std::equal(a.begin, a.end, b.begin());
+}
+
+// find value of cookie in the value of header "Cookie"
+static bool find_cookie(const std::string& cookies, const std::string& name,
+                        const char*& value_begin, const char*& value_end) {
+    const char* p = cookies.data();
+    const char* end = p + cookies.size();
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ';')) {
+            ++p;
+        }
+        const char* pair_end = std::find(p, end, ';');
+        const char* eq = std::find(p, pair_end, '=');
+        if (eq != pair_end && size_t(eq - p) == name.size() &&
+                std::equal(p, eq, name.begin())) {
+            value_begin = eq + 1;
+            value_end = pair_end;
+            return true;
+        }
+        p = pair_end;
+    }
+    return false;
+}
+
+bool EtagStoreResource::handle_etag(const Http::Request& request,
                                     Http::Response& response) {
     // TODO http://redmine.webtoolkit.eu/issues/2471
     // const std::string* cookie_value = request.getCookieValue(cookie_name_);
-    std::string cookies = request.headerValue("Cookie");
-    if (cookies.empty()) {
-        return;
+    // Wt returns copies of header values
+    std::string cookies = request.headerValue(COOKIE);
+    std::string etag_value = request.headerValue(receive_header());
+    bool not_modified = handle_headers(cookies, etag_value);
+    if (!etag_value.empty()) {
+        response.addHeader(send_header(), etag_value);
     }
-    std::string pattern = cookie_name_ + "=";
-    int cookie_begin = cookies.find(pattern);
-    if (cookie_begin == std::string::npos) {
-        return;
+    return not_modified;
+}
+
+bool EtagStoreResource::handle_headers(const std::string& cookies,
+                                       std::string& etag_value) {
+    StringRef cookie_value;
+    if (!find_cookie(cookies, cookie_name_,
+                     cookie_value.begin, cookie_value.end)) {
+        etag_value.clear();
+        return false;
     }
-    cookie_begin += pattern.length();
-    int cookie_end = cookies.find(';', cookie_begin);
-    int cookie_length = (cookie_end == -1) ? -1 : (cookie_end - cookie_begin);
-    std::string cookie_value = cookies.substr(cookie_begin, cookie_length);
-    //
-    std::string etag_value = request.headerValue(receive_header());
-    boost::mutex::scoped_lock lock(cookie_to_etag_mutex_);
-    Map::iterator it = cookie_to_etag_.find(cookie_value);
-    if (it == cookie_to_etag_.end()) {
+    bool modified = false;
+    Values values;
+    Handler handler;
+    {
+        CookieHash hash;
+        CookieEqual equal;
+        Shard& shard = shard_of(hash(cookie_value));
+        boost::posix_time::ptime now =
+            boost::posix_time::microsec_clock::universal_time();
+        boost::mutex::scoped_lock lock(shard.mutex);
+        remove_expired(shard, now);
+        Map::iterator it = shard.map.find(cookie_value, hash, equal);
+        if (it == shard.map.end()) {
+            etag_value.clear();
+            return false;
+        }
+        Etag& etag = it->second;
+        shard.touch(&etag, now);
+        if (etag.clear || !etag.changes.empty()) {
+            modified = true;
+            if (!etag.clear) {
+                decode_values(etag_value, values);
+            }
+            BOOST_FOREACH (const Values::value_type& change, etag.changes) {
+                if (change.second.empty()) {
+                    values.erase(change.first);
+                } else {
+                    values[change.first] = change.second;
+                }
+            }
+            etag.changes.clear();
+            etag.clear = false;
+        }
+        if (etag.requested) {
+            // called outside the lock
+            handler = etag.handler;
+            etag.requested = false;
+        }
+    }
+    if (modified) {
+        etag_value.clear();
+        encode_values(values, etag_value);
+    }
+    if (handler) {
+        handler(etag_value);
+    }
+    // client has the image with this value
+    return !modified && !etag_value.empty();
+}
+
+void EtagStoreResource::encode_values(const Values& values,
+                                      std::string& out) {
+    // "&key1=value1&key2=value2"; empty set is encoded as "&"
+    BOOST_FOREACH (const Values::value_type& kv, values) {
+        out += '&';
+        urlencode(kv.first, out);
+        out += '=';
+        urlencode(kv.second, out);
+    }
+    if (out.empty()) {
+        out += '&';
+    }
+}
+
+void EtagStoreResource::decode_values(const std::string& text,
+                                      Values& values) {
+    if (text.empty() || text[0] != '&') {
+        // not set or written by other software
         return;
     }
-    Etag& etag = it->second;
-    if (etag_value.empty()) {
-        etag_value = etag.def;
+    // buffers are reused by all pairs
+    std::string key, part;
+    size_t pos = 1;
+    while (pos < text.size()) {
+        size_t pair_end = text.find('&', pos);
+        if (pair_end == std::string::npos) {
+            pair_end = text.size();
+        }
+        size_t eq = text.find('=', pos);
+        if (eq < pair_end) {
+            part.assign(text, pos, eq - pos);
+            key.clear();
+            urldecode(part, key);
+            std::string& value = values[key];
+            value.clear();
+            part.assign(text, eq + 1, pair_end - eq - 1);
+            urldecode(part, value);
+        }
+        pos = pair_end + 1;
     }
-    etag.from_client = etag_value;
-    if (!etag.to_client.empty()) {
-        response.addHeader(send_header(), etag.to_client);
-        etag.to_client.clear();
-    } else {
-        etag.handler(etag.from_client);
+}
+
+EtagStoreResource::Shard& EtagStoreResource::shard_of(size_t hash) {
+    // low bits of hash are used by buckets of unordered_map
+    return shards_[(hash >> 16) % SHARDS_NUMBER];
+}
+
+EtagStoreResource::Shard& EtagStoreResource::shard_of(
+    const std::string& cookie_value) {
+    return shard_of(CookieHash()(cookie_value));
+}
+
+// max number of expired etags removed by one access
+const int REMOVE_STEP = 4;
+
+EtagStoreResource::Etag& EtagStoreResource::etag_of(Shard& shard,
+        const std::string& cookie_value, const Handler& handler) {
+    // shard.mutex must be locked
+    boost::posix_time::ptime now =
+        boost::posix_time::microsec_clock::universal_time();
+    remove_expired(shard, now);
+    std::pair<Map::iterator, bool> inserted =
+        shard.map.insert(Map::value_type(cookie_value, Etag()));
+    Etag& etag = inserted.first->second;
+    if (inserted.second) {
+        // new or expired (and still used) entry
+        etag.handler = handler;
+        etag.cookie_value = &inserted.first->first;
+        shard.append(&etag);
     }
-    if (!etag.from_client.empty()) {
-        response.addHeader(send_header(), etag.from_client);
+    shard.touch(&etag, now);
+    return etag;
+}
+
+void EtagStoreResource::remove_expired(Shard& shard,
+                                       const boost::posix_time::ptime& now) {
+    // shard.mutex must be locked
+    boost::posix_time::ptime min_access = now - shard.idle_timeout;
+    for (int i = 0; i < REMOVE_STEP && shard.first; ++i) {
+        if (shard.first->last_access >= min_access) {
+            // other etags were accessed later
+            break;
+        }
+        remove(shard, shard.map.find(*shard.first->cookie_value));
     }
 }
 
+void EtagStoreResource::remove(Shard& shard, Map::iterator it) {
+    // shard.mutex must be locked
+    shard.unlink(&it->second);
+    shard.map.erase(it);
+}
+
 EtagStore::EtagStore(EtagStoreResource* resource, WContainerWidget* parent):
     AbstractStore(parent), resource_(resource) {
     cookie_value_ = rand_string();
     int day = 3600 * 24;
     wApp->setCookie(resource_->cookie_name(), cookie_value_, day);
+    handler_ = one_bound_post<std::string>(
+                   boost::bind(&EtagStore::emit_value, this, _1));
     {
-        boost::mutex::scoped_lock lock(resource_->cookie_to_etag_mutex_);
-        typedef EtagStoreResource::Etag Etag;
-        Etag& etag = resource_->cookie_to_etag_[cookie_value_];
-        etag.handler = one_bound_post(boost::bind(&EtagStore::emit_value,
-                                      this, _1));
+        EtagStoreResource::Shard& shard = resource_->shard_of(cookie_value_);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        resource_->etag_of(shard, cookie_value_, handler_);
     }
     resize(0, 0);
     wApp->enableUpdates();
 }
 
 EtagStore::~EtagStore() {
-    boost::mutex::scoped_lock lock(resource_->cookie_to_etag_mutex_);
-    resource_->cookie_to_etag_.erase(cookie_value_);
+    EtagStoreResource::Shard& shard = resource_->shard_of(cookie_value_);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    EtagStoreResource::Map::iterator it = shard.map.find(cookie_value_);
+    if (it != shard.map.end()) {
+        resource_->remove(shard, it);
+    }
 }
 
 void EtagStore::clear_storage_impl() {
-    set_item_impl(key_, "");
+    change(true, "", "");
 }
 
 void EtagStore::set_item_impl(const std::string& key,
                               const std::string& value) {
-    {
-        boost::mutex::scoped_lock lock(resource_->cookie_to_etag_mutex_);
-        typedef EtagStoreResource::Etag Etag;
-        Etag& etag = resource_->cookie_to_etag_[cookie_value_];
-        etag.to_client = value;
-    }
-    key_ = key;
-    update_image();
+    change(false, key, value);
 }
 
 void EtagStore::remove_item_impl(const std::string& key) {
-    set_item_impl(key, "");
+    change(false, key, "");
 }
 
 void EtagStore::get_value_of_impl(const std::string& key,
                                   const std::string& def) {
+    requested_[key] = def;
     {
-        boost::mutex::scoped_lock lock(resource_->cookie_to_etag_mutex_);
-        resource_->cookie_to_etag_[cookie_value_].def = def;
+        // re-creates the entry, if it was removed as expired
+        EtagStoreResource::Shard& shard = resource_->shard_of(cookie_value_);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        EtagStoreResource::Etag& etag = resource_->etag_of(shard,
+                                        cookie_value_, handler_);
+        etag.requested = true;
+    }
+    update_image();
+}
+
+void EtagStore::change(bool clear, const std::string& key,
+                       const std::string& value) {
+    {
+        EtagStoreResource::Shard& shard = resource_->shard_of(cookie_value_);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        EtagStoreResource::Etag& etag = resource_->etag_of(shard,
+                                        cookie_value_, handler_);
+        if (clear) {
+            etag.clear = true;
+            etag.changes.clear();
+        } else {
+            etag.changes[key] = value;
+        }
     }
-    key_ = key;
     update_image();
 }
 
@@ -141,11 +371,22 @@ void EtagStore::update_image() {
     WImage* image = new WImage(resource_->url());
     addWidget(image);
     image->resize(0, 0);
-    wApp->triggerUpdate();
+    updates_trigger();
 }
 
-void EtagStore::emit_value(const boost::any& result) {
-    value().emit(key_, boost::any_cast<std::string>(result));
+void EtagStore::emit_value(const std::string& result) {
+    if (requested_.empty()) {
+        return;
+    }
+    EtagStoreResource::Values values;
+    EtagStoreResource::decode_values(result, values);
+    EtagStoreResource::Values requested;
+    requested.swap(requested_);
+    BOOST_FOREACH (const EtagStoreResource::Values::value_type& kv,
+                   requested) {
+        EtagStoreResource::Values::const_iterator it = values.find(kv.first);
+        value().emit(kv.first, it == values.end() ? kv.second : it->second);
+    }
 }
 
 }
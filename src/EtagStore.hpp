@@ -9,16 +9,19 @@
 #define WC_ETAG_STORE_HPP_
 
 #include <map>
-#include <boost/any.hpp>
+#include <string>
 #include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
 #include "boost-xtime.hpp"
 #include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include <Wt/WGlobal>
 #include <Wt/WResource>
 #include <Wt/WContainerWidget>
 
 #include "AbstractStore.hpp"
+#include "TimeDuration.hpp"
 
 namespace Wt {
 
@@ -27,6 +30,11 @@ namespace Wc {
 /** A resource storing data on in browser cache (like cookies).
 Should be used with EtagStore.
 See EtagStore.
+
+All keys of a client are stored in one value of the header,
+so one request of the image reads and writes any number of keys.
+Changes made by the session are merged with the value sent by the client
+when the image is requested.
 */
 class EtagStoreResource : public WResource {
 public:
@@ -43,9 +51,23 @@ public:
                       const std::string& receive_header = "If-None-Match",
                       WObject* parent = 0);
 
-    /** Handles a request */
+    /** Handles a request.
+    If the client sends the value, which is not changed,
+    "304 Not Modified" is returned without the image.
+    */
     void handleRequest(const Http::Request& request, Http::Response& response);
 
+    /** Process values of headers of a request of the image.
+    \param cookies Value of header "Cookie".
+    \param etag_value Value of receive_header() on input,
+        value of send_header() on output (empty means no header).
+
+    Returns if the client has the current value (304 Not Modified).
+    This is the work of handleRequest() without Http::Request,
+    which can be used for tests and benchmarks.
+    */
+    bool handle_headers(const std::string& cookies, std::string& etag_value);
+
     /** Return name of cookie used to distinguish clients */
     const std::string& cookie_name() const {
         return cookie_name_;
@@ -61,27 +83,98 @@ public:
         return receive_header_;
     }
 
+    /** Return time after which data of inactive client is removed.
+    Defaults to 1 day (lifetime of the cookie).
+    */
+    td::TimeDuration idle_timeout() const;
+
+    /** Set time after which data of inactive client is removed.
+    This removes data of sessions, which were not destroyed properly.
+    Data is removed incrementally by requests of the image
+    and by changes made by sessions.
+    */
+    void set_idle_timeout(const td::TimeDuration& idle_timeout);
+
 private:
+    typedef boost::function<void(const std::string&)> Handler;
+
+    typedef std::map<std::string, std::string> Values;
+
     struct Etag {
-        typedef boost::function<void(const boost::any&)> OneAnyFunc;
-        OneAnyFunc handler;
-        std::string from_client;
-        std::string to_client;
-        std::string def;
+        Handler handler;
+        // changes, which were not yet sent to client; empty value = removed
+        Values changes;
+        bool clear;
+        // the session waits for values (get_value_of() was called)
+        bool requested;
+        boost::posix_time::ptime last_access;
+        const std::string* cookie_value;
+        // list of etags of the shard, ordered by last_access
+        Etag* prev;
+        Etag* next;
+
+        Etag():
+            clear(false), requested(false), cookie_value(0), prev(0), next(0)
+        { }
+    };
+
+    // part of string, used to find cookie value without copying
+    struct StringRef {
+        const char* begin;
+        const char* end;
+    };
+
+    struct CookieHash {
+        size_t operator()(const std::string& s) const;
+        size_t operator()(const StringRef& s) const;
+    };
+
+    struct CookieEqual {
+        bool operator()(const std::string& a, const std::string& b) const {
+            return a == b;
+        }
+
+        bool operator()(const StringRef& a, const std::string& b) const;
     };
-    typedef std::map<std::string, Etag> Map;
-    Map cookie_to_etag_;
-    boost::mutex cookie_to_etag_mutex_;
+
+    typedef boost::unordered_map<std::string, Etag,
+            CookieHash, CookieEqual> Map;
+
+    // clients are distributed among shards to reduce lock contention
+    struct Shard {
+        Map map;
+        Etag* first;
+        Etag* last;
+        // copy of idle timeout, protected by the mutex
+        boost::posix_time::time_duration idle_timeout;
+        boost::mutex mutex;
+
+        Shard();
+        void unlink(Etag* etag);
+        void append(Etag* etag);
+        void touch(Etag* etag, const boost::posix_time::ptime& now);
+    };
+
+    static const int SHARDS_NUMBER = 16;
+    mutable Shard shards_[SHARDS_NUMBER];
     std::string cookie_name_;
     std::string send_header_;
     std::string receive_header_;
 
-    void handle_etag(const Http::Request& request, Http::Response& response);
+    bool handle_etag(const Http::Request& request, Http::Response& response);
+    Shard& shard_of(size_t hash);
+    Shard& shard_of(const std::string& cookie_value);
+    Etag& etag_of(Shard& shard, const std::string& cookie_value,
+                  const Handler& handler);
+    void remove_expired(Shard& shard, const boost::posix_time::ptime& now);
+    void remove(Shard& shard, Map::iterator it);
+    static void encode_values(const Values& values, std::string& out);
+    static void decode_values(const std::string& text, Values& values);
 
     friend class EtagStore;
 };
 
-/** A widget storing data on in browser cache (like cookies).
+/** A widget storing key-value data on in browser cache (like cookies).
 
 For information on tracking using ETag,
 see http://lucb1e.com/rp/cookielesscookies/.
@@ -98,9 +191,10 @@ Gather* gather = new Gather(...);
 gather->add_store(store, Gather::ETAG);
 \endcode
 
-\note Key is meaningless. For any key, same value is stored/returned.
-    To store several items using this method, use several EtagStoreResource
-    instances on several paths and several EtagStore instances.
+All keys are packed into one value of ETag,
+so several calls of set_item() and get_value_of() made during
+handling of one event result in one request of the image.
+Setting empty value is equivalent to remove_item().
 
 \ingroup bindings
 */
@@ -112,6 +206,11 @@ public:
     /** Destructor */
     ~EtagStore();
 
+    /** Return value of the cookie, identifying the client */
+    const std::string& cookie_value() const {
+        return cookie_value_;
+    }
+
 protected:
     void clear_storage_impl();
 
@@ -124,10 +223,14 @@ protected:
 private:
     EtagStoreResource* resource_;
     std::string cookie_value_;
-    std::string key_;
+    // key to default value
+    EtagStoreResource::Values requested_;
+    EtagStoreResource::Handler handler_;
+
+    void change(bool clear, const std::string& key, const std::string& value);
 
     void update_image();
-    void emit_value(const boost::any& result);
+    void emit_value(const std::string& result);
 };
 
 }
@@ -0,0 +1,220 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <set>
+#include <sstream>
+#include "boost-xtime.hpp"
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/once.hpp>
+#include <boost/asio.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Executor.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+typedef boost::asio::deadline_timer Timer;
+typedef boost::shared_ptr<Timer> TimerPtr;
+
+class Executor::Impl {
+public:
+    boost::asio::io_service io;
+    boost::scoped_ptr<boost::asio::io_service::work> work;
+    boost::thread_group group;
+    // timers waiting to fire; they are canceled by shutdown()
+    std::set<TimerPtr> timers;
+    boost::mutex timers_mutex;
+
+    void schedule(const td::TimeDuration& wait, const Func& func) {
+        TimerPtr timer(new Timer(io, wait));
+        {
+            boost::mutex::scoped_lock lock(timers_mutex);
+            timers.insert(timer);
+        }
+        timer->async_wait(boost::bind(&Impl::handle_timeout, this, timer,
+                                      func, boost::asio::placeholders::error));
+    }
+
+    void handle_timeout(TimerPtr timer, const Func& func,
+                        const boost::system::error_code& e) {
+        {
+            boost::mutex::scoped_lock lock(timers_mutex);
+            timers.erase(timer);
+        }
+        if (!e) {
+            func();
+        }
+    }
+
+    void cancel_timers() {
+        boost::mutex::scoped_lock lock(timers_mutex);
+        BOOST_FOREACH (const TimerPtr& timer, timers) {
+            boost::system::error_code e;
+            timer->cancel(e);
+        }
+    }
+};
+
+Executor::Executor(int threads, const std::string& name):
+    impl_(new Impl), state_(NEW), threads_(threads), name_(name)
+{ }
+
+Executor::~Executor() {
+    shutdown();
+    delete impl_;
+}
+
+static Executor* default_executor = 0;
+static boost::once_flag default_executor_flag = BOOST_ONCE_INIT;
+
+static void create_default_executor() {
+    static Executor executor;
+    default_executor = &executor;
+}
+
+Executor& Executor::instance() {
+    boost::call_once(create_default_executor, default_executor_flag);
+    return *default_executor;
+}
+
+int Executor::threads() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return threads_;
+}
+
+void Executor::set_threads(int threads) {
+    boost::mutex::scoped_lock lock(mutex_);
+    threads_ = threads;
+}
+
+std::string Executor::name() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return name_;
+}
+
+void Executor::set_name(const std::string& name) {
+    boost::mutex::scoped_lock lock(mutex_);
+    name_ = name;
+}
+
+std::vector<int> Executor::cpu_affinity() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return cpus_;
+}
+
+void Executor::set_cpu_affinity(const std::vector<int>& cpus) {
+    boost::mutex::scoped_lock lock(mutex_);
+    cpus_ = cpus;
+}
+
+Executor::State Executor::state() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return state_;
+}
+
+void Executor::start() {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (state_ != NEW) {
+        return;
+    }
+    int threads = threads_;
+    if (threads <= 0) {
+        threads = boost::thread::hardware_concurrency();
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+    impl_->work.reset(new boost::asio::io_service::work(impl_->io));
+    for (int i = 0; i < threads; i++) {
+        impl_->group.create_thread(boost::bind(&Executor::run_thread, this, i));
+    }
+    state_ = RUNNING;
+}
+
+void Executor::post(const Func& func) {
+    State s = state();
+    if (s == NEW) {
+        start();
+    } else if (s == STOPPED) {
+        return;
+    }
+    impl_->io.post(func);
+}
+
+void Executor::schedule(const td::TimeDuration& wait, const Func& func) {
+    if (wait <= td::TD_NULL) {
+        post(func);
+        return;
+    }
+    State s = state();
+    if (s == NEW) {
+        start();
+    } else if (s != RUNNING) {
+        return;
+    }
+    impl_->schedule(wait, func);
+}
+
+void Executor::shutdown() {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (state_ != RUNNING) {
+            state_ = STOPPED;
+            return;
+        }
+        state_ = STOPPING;
+    }
+    impl_->cancel_timers();
+    impl_->work.reset();
+    impl_->group.join_all();
+    boost::mutex::scoped_lock lock(mutex_);
+    state_ = STOPPED;
+}
+
+void Executor::run_thread(int index) {
+#ifdef __linux__
+    std::string name;
+    std::vector<int> cpus;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        name = name_;
+        cpus = cpus_;
+    }
+    std::stringstream thread_name;
+    thread_name << name << '-' << index;
+    pthread_setname_np(pthread_self(), thread_name.str().substr(0, 15).c_str());
+    if (!cpus.empty()) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpus[index % cpus.size()], &cpu_set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    }
+#endif
+    while (true) {
+        try {
+            impl_->io.run();
+            break;
+        } catch (...) {
+            // exception from a function; continue running
+        }
+    }
+}
+
+}
+
+}
+
@@ -0,0 +1,154 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef WC_EXECUTOR_HPP_
+#define WC_EXECUTOR_HPP_
+
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
+
+#include "TimeDuration.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+/** Pool of threads executing posted and scheduled functions.
+
+Threads are started lazily, by first call of post() or schedule()
+(or explicitly by start()).
+So a process which never uses the executor does not pay for its threads.
+
+The default executor, instance(), is used by schedule_action()
+(unless WIOService of WServer is available).
+It can also be used by notify::PlanningServer (see
+notify::PlanningServer::set_executor()) and Wbi runners
+(see AbstractRunner::set_executor()).
+
+Configure the executor before it is started:
+\code
+Executor& executor = Executor::instance();
+executor.set_threads(4);
+executor.set_name("my-app-pool");
+std::vector<int> cpus;
+cpus.push_back(2);
+cpus.push_back(3);
+executor.set_cpu_affinity(cpus);
+\endcode
+
+Exceptions, thrown by executed functions, are caught and ignored.
+
+\ingroup util
+*/
+class Executor {
+public:
+    /** Function executed by the executor */
+    typedef boost::function<void()> Func;
+
+    /** State of the executor */
+    enum State {
+        NEW, /**< Threads are not started yet */
+        RUNNING, /**< Threads are running */
+        STOPPING, /**< shutdown() was called, threads are being drained */
+        STOPPED /**< Threads are stopped, new functions are ignored */
+    };
+
+    /** Constructor.
+    \param threads Number of threads (0 means number of CPUs).
+    \param name Name of threads (visible in debuggers and top; Linux only).
+    */
+    Executor(int threads = 0, const std::string& name = "wc-executor");
+
+    /** Destructor. Calls shutdown() */
+    virtual ~Executor();
+
+    /** Return default executor */
+    static Executor& instance();
+
+    /** Get number of threads (0 means number of CPUs) */
+    int threads() const;
+
+    /** Set number of threads (0 means number of CPUs).
+    \note This does not affect already started executor.
+    */
+    void set_threads(int threads);
+
+    /** Get name of threads */
+    std::string name() const;
+
+    /** Set name of threads.
+    Thread number is added to the name; the result is truncated to 15 chars.
+    \note This does not affect already started executor.
+    */
+    void set_name(const std::string& name);
+
+    /** Get CPUs, to which threads are bound */
+    std::vector<int> cpu_affinity() const;
+
+    /** Set CPUs, to which threads are bound.
+    Thread number i is bound to CPU cpus[i % cpus.size()].
+    Empty list (default) means no binding.
+    Binding is supported on Linux only, otherwise it is ignored.
+    \note This does not affect already started executor.
+    */
+    void set_cpu_affinity(const std::vector<int>& cpus);
+
+    /** Get current state */
+    State state() const;
+
+    /** Start threads, if the state is NEW.
+    This method is called automatically by post() and schedule().
+    */
+    void start();
+
+    /** Execute the function in one of threads as soon as possible.
+    If the state is STOPPED, does nothing.
+    */
+    void post(const Func& func);
+
+    /** Execute the function in one of threads after the delay.
+    If the state is STOPPING or STOPPED, does nothing.
+    */
+    void schedule(const td::TimeDuration& wait, const Func& func);
+
+    /** Stop the executor.
+    Functions, already passed to post(), are executed.
+    Functions, passed to schedule() and not yet executed, are dropped.
+    This method waits until all threads are finished.
+
+    After this call, the state is STOPPED.
+
+    \attention This method must not be called from a thread of
+        the executor.
+    */
+    void shutdown();
+
+private:
+    class Impl;
+
+    Impl* impl_;
+    mutable boost::mutex mutex_;
+    State state_;
+    int threads_;
+    std::string name_;
+    std::vector<int> cpus_;
+
+    void run_thread(int index);
+
+    Executor(const Executor&);
+    Executor& operator=(const Executor&);
+};
+
+}
+
+}
+
+#endif
+
@@ -0,0 +1,141 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <boost/thread/once.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "HtmlCache.hpp"
+#include "util.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+// separates parts of key; must not be found in URL
+static const char KEY_SEPARATOR = '\x01';
+
+// URL in the form used by CachedContents (with trailing slash)
+static std::string fixed_url(const std::string& url) {
+    return (!url.empty() && *url.rbegin() == '/') ? url : url + "/";
+}
+
+static std::string make_key(const std::string& url, const std::string& locale,
+                            const std::string& variant) {
+    std::string key;
+    key.reserve(url.size() + locale.size() + variant.size() + 3);
+    key += fixed_url(url);
+    key += KEY_SEPARATOR;
+    key += locale;
+    key += KEY_SEPARATOR;
+    key += variant;
+    return key;
+}
+
+HtmlCache::HtmlCache():
+    max_size_(10000)
+{ }
+
+static HtmlCache* default_html_cache = 0;
+static boost::once_flag default_html_cache_once = BOOST_ONCE_INIT;
+
+static void create_default_html_cache() {
+    static HtmlCache cache;
+    default_html_cache = &cache;
+}
+
+HtmlCache& HtmlCache::instance() {
+    boost::call_once(default_html_cache_once, create_default_html_cache);
+    return *default_html_cache;
+}
+
+bool HtmlCache::get(const std::string& url, const std::string& locale,
+                    const std::string& variant,
+                    std::string& html, std::string& title) const {
+    std::string key = make_key(url, locale, variant);
+    boost::mutex::scoped_lock lock(mutex_);
+    Pages::const_iterator it = pages_.find(key);
+    if (it == pages_.end() || it->second.expires < now()) {
+        return false;
+    }
+    html = it->second.html;
+    title = it->second.title;
+    return true;
+}
+
+void HtmlCache::put(const std::string& url, const std::string& locale,
+                    const std::string& variant,
+                    const std::string& html, const std::string& title,
+                    const td::TimeDuration& ttl) {
+    std::string key = make_key(url, locale, variant);
+    WDateTime expires = now() + ttl;
+    boost::mutex::scoped_lock lock(mutex_);
+    if (int(pages_.size()) >= max_size_ && pages_.find(key) == pages_.end()) {
+        remove_expired();
+        if (int(pages_.size()) >= max_size_) {
+            return;
+        }
+    }
+    Page& page = pages_[key];
+    page.html = html;
+    page.title = title;
+    page.expires = expires;
+}
+
+void HtmlCache::invalidate(const std::string& url) {
+    std::string fixed = fixed_url(url);
+    boost::mutex::scoped_lock lock(mutex_);
+    remove_range(fixed + KEY_SEPARATOR, fixed + char(KEY_SEPARATOR + 1));
+}
+
+void HtmlCache::invalidate_prefix(const std::string& prefix) {
+    boost::mutex::scoped_lock lock(mutex_);
+    Pages::iterator it = pages_.lower_bound(prefix);
+    while (it != pages_.end() && boost::starts_with(it->first, prefix)) {
+        pages_.erase(it++);
+    }
+}
+
+void HtmlCache::clear() {
+    boost::mutex::scoped_lock lock(mutex_);
+    pages_.clear();
+}
+
+int HtmlCache::size() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return pages_.size();
+}
+
+int HtmlCache::max_size() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_size_;
+}
+
+void HtmlCache::set_max_size(int max_size) {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_size_ = max_size;
+}
+
+void HtmlCache::remove_expired() {
+    WDateTime current = now();
+    for (Pages::iterator it = pages_.begin(); it != pages_.end();) {
+        if (it->second.expires < current) {
+            pages_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void HtmlCache::remove_range(const std::string& begin,
+                             const std::string& end) {
+    pages_.erase(pages_.lower_bound(begin), pages_.lower_bound(end));
+}
+
+}
+
+}
+
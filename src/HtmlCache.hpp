@@ -0,0 +1,109 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef WC_HTML_CACHE_HPP_
+#define WC_HTML_CACHE_HPP_
+
+#include <map>
+#include <string>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
+
+#include <Wt/WDateTime>
+
+#include "TimeDuration.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+/** Process-wide cache of rendered HTML, shared by sessions.
+
+The cache maps (URL, locale, variant) to HTML and title of the page.
+Variant is an arbitrary string, defined by the application
+(for example, "guest" or a name of a theme).
+
+It is used by CachedContents for HTML (non-Ajax) sessions
+(see CachedContents::set_html_cacheable()),
+so crawlers and clients without JavaScript do not cause
+building of widget tree for each request.
+
+URLs are internal paths.
+Trailing slash is added to them, as CachedContents does,
+so "/page" and "/page/" are the same URL.
+
+Entries expire after TTL, passed to put().
+They can also be removed explicitly by invalidate().
+
+\ingroup url
+*/
+class HtmlCache {
+public:
+    /** Constructor */
+    HtmlCache();
+
+    /** Return default cache */
+    static HtmlCache& instance();
+
+    /** Find HTML and title of the page.
+    Returns false if not found or expired.
+    */
+    bool get(const std::string& url, const std::string& locale,
+             const std::string& variant,
+             std::string& html, std::string& title) const;
+
+    /** Store HTML and title (UTF-8) of the page for the given time */
+    void put(const std::string& url, const std::string& locale,
+             const std::string& variant,
+             const std::string& html, const std::string& title,
+             const td::TimeDuration& ttl);
+
+    /** Remove all entries of the URL (all locales and variants) */
+    void invalidate(const std::string& url);
+
+    /** Remove all entries of URLs starting with the prefix */
+    void invalidate_prefix(const std::string& prefix);
+
+    /** Remove all entries */
+    void clear();
+
+    /** Return number of entries (including expired ones) */
+    int size() const;
+
+    /** Return max number of entries.
+    Defaults to 10000.
+    */
+    int max_size() const;
+
+    /** Set max number of entries.
+    If the number of entries exceeds it, expired entries are removed;
+    if this is not enough, new entries are not stored.
+    */
+    void set_max_size(int max_size);
+
+private:
+    struct Page {
+        std::string html;
+        std::string title;
+        WDateTime expires;
+    };
+
+    typedef std::map<std::string, Page> Pages;
+    Pages pages_;
+    int max_size_;
+    mutable boost::mutex mutex_;
+
+    void remove_expired();
+    void remove_range(const std::string& begin, const std::string& end);
+};
+
+}
+
+}
+
+#endif
+
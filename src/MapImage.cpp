@@ -57,11 +57,9 @@ public:
             if (comma_pos != std::string::npos) {
                 std::string x_str = xy_str->substr(1, comma_pos - 1);
                 std::string y_str = xy_str->substr(comma_pos + 1);
-                try {
-                    int x = boost::lexical_cast<int>(x_str);
-                    int y = boost::lexical_cast<int>(y_str);
+                int x, y;
+                if (parse_integer(x_str, x) && parse_integer(y_str, y)) {
                     xy = WMouseEvent::Coordinates(x, y);
-                } catch (...) {
                 }
             }
         }
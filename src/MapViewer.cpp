@@ -8,6 +8,7 @@
 #include "global.hpp"
 
 #include <cmath>
+#include <algorithm>
 #include <iomanip>
 
 #include <boost/math/constants/constants.hpp>
@@ -52,6 +53,9 @@
 #include "MapViewer.hpp"
 #include "util.hpp"
 #include "MapImage.hpp"
+#ifdef WC_HAVE_TILE_RESOURCE
+#include "TileResource.hpp"
+#endif
 
 namespace Wt {
 
@@ -74,6 +78,9 @@ MapViewer::MapViewer(Wt::WContainerWidget* p):
 #if defined(WC_HAVE_WHTTP_MESSAGE) && defined(WC_HAVE_JSON_OBJECT)
     , http_(0), tz_http_(0)
 #endif
+    , tile_resource_(0), viewport_image_(false), html_map_cw_(0),
+    html_markers_cw_(0), html_tiles_cw_(0), html_layer_cw_(0),
+    html_search_cw_(0), html_zoom_(-1)
 {
     wApp->require("http://openlayers.org/api/OpenLayers.js",
                   "OpenLayers");
@@ -114,12 +121,14 @@ void MapViewer::update_impl() {
         M click_on = &MapViewer::click_on;
         jclicked().connect(boost::bind(click_on, this, _1));
         doJavaScript(store_jsv(map_name_, map_created_str));
-        add_osm_layer(layer_name_);
+        add_osm_layer(layer_name_, osm_layer_param());
         set_click_signal_();
         wApp->styleSheet().addRule(".olControlAttribution",
                                    "position:absolute !important;"
                                    "bottom:0 !important;right:0 !important;");
     } else {
+        // impl is cleared
+        html_map_cw_ = 0;
         html_v(get_impl());
     }
 }
@@ -136,6 +145,31 @@ void MapViewer::add_osm_layer(const std::string& layer_var_name,
     }
 }
 
+#ifdef WC_HAVE_TILE_RESOURCE
+void MapViewer::set_tile_resource(TileResource* tile_resource) {
+    tile_resource_ = tile_resource;
+    if (js()) {
+        remove_layer();
+        add_osm_layer(layer_name_, osm_layer_param());
+    } else {
+        if (html_map_cw_) {
+            // URLs of tiles are changed
+            html_tiles_clear();
+        }
+        html_v(get_impl());
+    }
+}
+#endif
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+void MapViewer::set_viewport_image(bool enabled) {
+    viewport_image_ = enabled;
+    if (!js()) {
+        html_v(get_impl());
+    }
+}
+#endif
+
 void MapViewer::remove_layer() {
     doJavaScript(get_stored_jsv(map_name_) + ".removeLayer("
                  + get_stored_jsv(layer_name_) + ", false);");
@@ -328,8 +362,6 @@ WContainerWidget* MapViewer::get_html_map() {
     //
     std::vector<int> img_margin(4, 0);
     WContainerWidget* gcw = new WContainerWidget();
-    wApp->styleSheet().addRule(".mapContainer",
-                               "position:relative;top:0px;");
     gcw->setStyleClass("mapContainer");
     WGridLayout* gl = new WGridLayout();
     gl->setHorizontalSpacing(0);
@@ -342,7 +374,6 @@ WContainerWidget* MapViewer::get_html_map() {
         X = 0;
     }
     for (int i = 0; i < row; i++) {
-        std::string ystd = TO_S(y);
         bool vori = false;
         int cw_h = 256;
         img_margin[3] = 0;
@@ -359,11 +390,8 @@ WContainerWidget* MapViewer::get_html_map() {
         }
         int x = X;
         for (int j = 0; j < column; j++) {
-            std::string xstd = TO_S(x);
             WContainerWidget* cw = new WContainerWidget();
-            WImage* img = new WImage("http://a.tile.openstreetmap.org/" +
-                                     TO_S(zoom_) +
-                                     "/" + xstd + "/" + ystd + ".png");
+            WImage* img = new WImage(tile_url(zoom_, x, y));
             bool hori = false;
             int cw_w = 256;
             img_margin[0] = 0;
@@ -399,19 +427,139 @@ WContainerWidget* MapViewer::get_html_map() {
     return gcw;
 }
 
-void MapViewer::html_markers_view(WContainerWidget* cw) {
-    int cout = 0;
+void MapViewer::html_tiles_update(int width, int height) {
+    WPointF center = w2p(pos_.first, zoom_);
+    // y is infinite at poles
+    double map_size = 256.0 * std::pow(2.0, zoom_);
+    int left = round(center.x()) - width / 2;
+    int top = round(std::min(std::max(center.y(), 0.0), map_size)) -
+              height / 2;
+    int x0 = floor(left / 256.0);
+    int x1 = floor((left + width - 1) / 256.0);
+    int y0 = floor(top / 256.0);
+    int y1 = floor((top + height - 1) / 256.0);
+    if (!html_layer_cw_ || html_zoom_ != zoom_) {
+        html_tiles_clear();
+        html_layer_cw_ = new WContainerWidget(html_tiles_cw_);
+        html_layer_cw_->setPositionScheme(Absolute);
+        html_zoom_ = zoom_;
+        html_origin_ = WPoint(x0, y0);
+    }
+    html_tiles_cw_->resize(width, height);
+    // a pan moves the layer, positions of tiles in it are not changed
+    html_layer_cw_->setOffsets(html_origin_.x() * 256 - left, Left);
+    html_layer_cw_->setOffsets(html_origin_.y() * 256 - top, Top);
+    int n = 1 << zoom_;
+    HtmlTiles tiles;
+    for (int row = std::max(y0, 0); row <= std::min(y1, n - 1); row++) {
+        for (int column = x0; column <= x1; column++) {
+            std::string key = TO_S(zoom_) + "/" + TO_S(column) +
+                              "/" + TO_S(row);
+            HtmlTiles::iterator it = html_tiles_.find(key);
+            if (it != html_tiles_.end()) {
+                tiles.insert(*it);
+                html_tiles_.erase(it);
+            } else {
+                tiles[key] = html_tile(column, row);
+            }
+        }
+    }
+    // tiles which are not visible anymore
+    BOOST_FOREACH (const HtmlTiles::value_type& tile, html_tiles_) {
+        delete tile.second;
+    }
+    html_tiles_.swap(tiles);
+}
+
+WWidget* MapViewer::html_tile(int column, int row) {
+    int n = 1 << zoom_;
+    // the map is repeated horizontally
+    int x = (column % n + n) % n;
+    WImage* img = new WImage(tile_url(zoom_, x, row));
+    img->resize(256, 256);
+    MapImage* map_img = new MapImage(img, html_layer_cw_);
+    map_img->setPositionScheme(Absolute);
+    map_img->setOffsets((column - html_origin_.x()) * 256, Left);
+    map_img->setOffsets((row - html_origin_.y()) * 256, Top);
+    map_img->clicked().connect(boost::bind(&MapViewer::click_on_pixel,
+                                           this, WPoint(x * 256, row * 256),
+                                           _1));
+    return map_img;
+}
+
+void MapViewer::html_tiles_clear() {
+    html_tiles_cw_->clear();
+    html_tiles_.clear();
+    html_layer_cw_ = 0;
+}
+
+void MapViewer::html_styles() {
+    wApp->styleSheet().addRule(".map_cw", "position:relative;");
+    wApp->styleSheet().addRule(".mapContainer",
+                               "position:relative;top:0px;"
+                               "overflow:hidden;");
     wApp->styleSheet().addRule(".mvMarkers",
                                "position:absolute;z-index:2013;");
+}
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+WContainerWidget* MapViewer::get_html_viewport() {
+    int width = get_impl()->width().value();
+    int height = get_impl()->height().value();
+    WPointF center = w2p(pos_.first, zoom_);
+    // y is infinite at poles
+    double map_size = 256.0 * std::pow(2.0, zoom_);
+    int cx = round(center.x());
+    int cy = round(std::min(std::max(center.y(), 0.0), map_size));
+    WContainerWidget* cw = new WContainerWidget();
+    cw->setStyleClass("mapContainer");
+    cw->resize(width, height);
+    // the image covers the container and is cropped by it
+    int image_cx = cx, image_cy = cy;
+    int image_width = width, image_height = height;
+    TileResource::snap_viewport(image_cx, image_cy, image_width, image_height);
+    WPoint origin(image_cx - image_width / 2, image_cy - image_height / 2);
+    WImage* img = new WImage(tile_resource_->viewport_url(zoom_,
+                             image_cx, image_cy, image_width, image_height));
+    MapImage* map_img = new MapImage(img, cw);
+    map_img->setPositionScheme(Absolute);
+    map_img->setOffsets(origin.x() - (cx - width / 2), Left);
+    map_img->setOffsets(origin.y() - (cy - height / 2), Top);
+    map_img->clicked().connect(boost::bind(&MapViewer::click_on_pixel,
+                                           this, origin, _1));
+    return cw;
+}
+#endif
+
+std::string MapViewer::tile_url(int zoom, int x, int y) const {
+#ifdef WC_HAVE_TILE_RESOURCE
+    if (tile_resource_) {
+        return tile_resource_->tile_url(zoom, x, y);
+    }
+#endif
+    return "http://a.tile.openstreetmap.org/" + TO_S(zoom) +
+           "/" + TO_S(x) + "/" + TO_S(y) + ".png";
+}
+
+std::string MapViewer::osm_layer_param() const {
+#ifdef WC_HAVE_TILE_RESOURCE
+    if (tile_resource_) {
+        return "'OpenStreetMap', '" + tile_resource_->tile_url_template() + "'";
+    }
+#endif
+    return "";
+}
+
+void MapViewer::html_markers_view(WContainerWidget* cw) {
+    int cout = 0;
     BOOST_FOREACH (const GeoNode& mn, marker_nodes_) {
         if (is_map_contained(mn.first)) {
             WPoint coords = w2px(mn.first);
             WImage* link_img = new WImage(marker_img_url_, cw);
             link_img->setStyleClass("mvMarkers");
             link_img->setId("mvMarker" + TO_S(cout));
-            wApp->styleSheet().addRule("#mvMarker" + TO_S(cout),
-                                       "top:" + TO_S(coords.y() - 25) + "px;"
-                                       "left:" + TO_S(coords.x() - 11) + "px;");
+            link_img->setOffsets(coords.y() - 25, Top);
+            link_img->setOffsets(coords.x() - 11, Left);
         }
         cout++;
     }
@@ -524,20 +672,48 @@ WContainerWidget* MapViewer::html_search_panel() {
 }
 
 void MapViewer::html_v(WContainerWidget* cw) {
-    cw->clear();
-    WContainerWidget* map_cw = new WContainerWidget();
-    map_cw->setStyleClass("map_cw");
-    wApp->styleSheet().addRule(".map_cw", "position:relative;");
+    if (!html_map_cw_) {
+        // parts which do not depend on the view are created once
+        cw->clear();
+        html_styles();
+        html_map_cw_ = new WContainerWidget();
+        html_map_cw_->setStyleClass("map_cw");
+        html_markers_cw_ = new WContainerWidget(html_map_cw_);
+        html_tiles_cw_ = new WContainerWidget(html_map_cw_);
+        html_tiles_cw_->setStyleClass("mapContainer");
+        html_tiles_.clear();
+        html_layer_cw_ = 0;
+        html_search_cw_ = 0;
+        cw->setContentAlignment(AlignTop);
+        cw->addWidget(get_html_control_panel());
+        cw->addWidget(html_map_cw_);
+        cw->addWidget(get_html_osm_attribution());
+    }
+    if (html_search_panel_ && !html_search_cw_) {
+        html_search_cw_ = html_search_panel();
+        cw->addWidget(html_search_cw_);
+    }
+    html_markers_cw_->clear();
     if (markers_ && zoom_ > 4) {
-        html_markers_view(map_cw);
+        html_markers_view(html_markers_cw_);
+    }
+    int width = get_impl()->width().value();
+    int height = get_impl()->height().value();
+    bool sized = width > 0 && height > 0;
+#ifdef WC_HAVE_TILE_VIEWPORT
+    if (sized && viewport_image_ && tile_resource_) {
+        html_tiles_clear();
+        html_tiles_cw_->addWidget(get_html_viewport());
+        return;
     }
-    map_cw->addWidget(get_html_map());
-    cw->setContentAlignment(AlignTop);
-    cw->addWidget(get_html_control_panel());
-    cw->addWidget(map_cw);
-    cw->addWidget(get_html_osm_attribution());
-    if (html_search_panel_) {
-        cw->addWidget(html_search_panel());
+#endif
+    if (sized) {
+        html_tiles_update(width, height);
+    } else {
+        // the grid is rebuilt from scratch
+        html_tiles_clear();
+        html_tiles_cw_->resize(WLength::Auto, WLength::Auto);
+        html_tiles_cw_->addWidget(get_html_map());
     }
 }
 
@@ -1039,6 +1215,28 @@ const WPoint MapViewer::w2px(const Coordinate& pos) const {
                   round(lat_diff * to_px_.second));
 }
 
+const WPointF MapViewer::w2p(const Coordinate& pos, int zoom) const {
+    // World to pixel position on the whole map.
+    double size = 256.0 * std::pow(2.0, zoom);
+    double x = (pos.longitude() + 180.0) / 360.0 * size;
+    double lat_rad = pos.latitude() * pi / 180.0;
+    double y = (1.0 - std::log(std::tan(lat_rad) + 1.0 /
+                               std::cos(lat_rad)) / pi) / 2.0 * size;
+    return WPointF(x, y);
+}
+
+const MapViewer::Coordinate MapViewer::p2w(const WPointF& pos,
+        int zoom) const {
+    // Pixel position on the whole map to World position.
+    double size = 256.0 * std::pow(2.0, zoom);
+    double lng = pos.x() / size * 360.0 - 180;
+    double n = pi - 2.0 * pi * pos.y() / size;
+    double lat = 180.0 / pi * atan(0.5 * (exp(n) - exp(-n)));
+    lng = coord_control(lng);
+    lat = coord_control(lat, "lat");
+    return MapViewer::Coordinate(lat, lng);
+}
+
 void MapViewer::map_param_calc() {
     std::pair<double, double> tl_size = tile_size();
     double width_half_of_map_in_w_coords = get_impl()->width().value()
@@ -1148,6 +1346,15 @@ void MapViewer::click_on(const WPoint& tile_xy,
     clicked_.emit(Coordinate(lat, lng));
 }
 
+void MapViewer::click_on_pixel(const WPoint& origin,
+                               const WMouseEvent::Coordinates& img_xy) {
+    if (img_xy.x < 0 || img_xy.y < 0) {
+        return;
+    }
+    WPointF pos(origin.x() + img_xy.x, origin.y() + img_xy.y);
+    clicked_.emit(p2w(pos, zoom_));
+}
+
 bool MapViewer::js() const {
     return wApp->environment().javaScript();
 }
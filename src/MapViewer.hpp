@@ -7,6 +7,7 @@
 #ifndef WC_MAP_VIEWER_HPP_
 #define WC_MAP_VIEWER_HPP_
 
+#include <map>
 #include <boost/function.hpp>
 #include <boost/system/error_code.hpp>
 
@@ -203,6 +204,39 @@ public:
     Signal<TZ>& time_zone(const Coordinate& pos,
                           bool ajax = true);
 
+#ifdef WC_HAVE_TILE_RESOURCE
+    /** Return the resource serving tiles (0 means OpenStreetMap servers) */
+    TileResource* tile_resource() const {
+        return tile_resource_;
+    }
+
+    /** Set the resource serving tiles.
+    Tiles are requested from the resource instead of OpenStreetMap servers
+    (both in Ajax and in HTML versions).
+    The resource is not owned by the map viewer.
+    0 means OpenStreetMap servers (default).
+    */
+    void set_tile_resource(TileResource* tile_resource);
+#endif
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+    /** Return if HTML version shows the map as one viewport image */
+    bool viewport_image() const {
+        return viewport_image_;
+    }
+
+    /** Set if HTML version shows the map as one viewport image.
+    Visible tiles are stitched into one image by the
+    \ref set_tile_resource "tile resource" (see TileResource::viewport_url())
+    instead of a grid of tile images.
+    This reduces number of widgets and browser requests per view.
+    Takes effect only if the tile resource is set and the size
+    of the map viewer is set in pixels.
+    Defaults to false.
+    */
+    void set_viewport_image(bool enabled = true);
+#endif
+
 protected:
     /** Layer Constructor.
     A Layer is a data source -- information about how OpenLayers
@@ -267,12 +301,33 @@ private:
     std::pair<int, int> tile_lt_;
     std::pair<double, double> to_px_;
     std::string marker_img_url_;
+    TileResource* tile_resource_;
+    bool viewport_image_;
+    //
+    typedef std::map<std::string, WWidget*> HtmlTiles;
+    WContainerWidget* html_map_cw_;
+    WContainerWidget* html_markers_cw_;
+    WContainerWidget* html_tiles_cw_;
+    WContainerWidget* html_layer_cw_;
+    WContainerWidget* html_search_cw_;
+    HtmlTiles html_tiles_;
+    int html_zoom_;
+    WPoint html_origin_;
 
     void destroy_map();
 
     Wt::WContainerWidget* get_impl();
 
     WContainerWidget* get_html_map();
+    void html_tiles_update(int width, int height);
+    WWidget* html_tile(int column, int row);
+    void html_tiles_clear();
+    void html_styles();
+#ifdef WC_HAVE_TILE_VIEWPORT
+    WContainerWidget* get_html_viewport();
+#endif
+    std::string tile_url(int zoom, int x, int y) const;
+    std::string osm_layer_param() const;
     void html_markers_view(WContainerWidget* cw);
     WContainerWidget* get_html_osm_attribution();
     WContainerWidget* get_html_control_panel();
@@ -314,6 +369,8 @@ private:
     const WPoint w2t(const Coordinate& pos, int zoom) const;
     const Coordinate t2w(const WPoint& pos, int zoom) const;
     const WPoint w2px(const Coordinate& pos) const;
+    const WPointF w2p(const Coordinate& pos, int zoom) const;
+    const Coordinate p2w(const WPointF& pos, int zoom) const;
 
     void map_param_calc();
     const CoordinatePair marginal_pic_coords(const WPoint& tile) const;
@@ -336,6 +393,8 @@ private:
     void click_on(const WPoint& tile_xy,
                   const WMouseEvent::Coordinates& img_xy);
     void click_on(const Coordinate& pos);
+    void click_on_pixel(const WPoint& origin,
+                        const WMouseEvent::Coordinates& img_xy);
 
     void set_click_signal_();
     const std::string set_ajax_action(const std::string& url,
@@ -0,0 +1,158 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <cstring>
+#include <istream>
+
+#include "Md5.hpp"
+#include "util.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+// RFC 1321
+static const uint32_t K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const int SHIFT[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static inline uint32_t rotate_left(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+Md5::Md5() {
+    reset();
+}
+
+void Md5::reset() {
+    state_[0] = 0x67452301;
+    state_[1] = 0xefcdab89;
+    state_[2] = 0x98badcfe;
+    state_[3] = 0x10325476;
+    size_ = 0;
+}
+
+void Md5::update(const void* data, size_t size) {
+    const unsigned char* input = static_cast<const unsigned char*>(data);
+    size_t used = size_t(size_ % 64);
+    size_ += size;
+    if (used) {
+        size_t free = 64 - used;
+        if (size < free) {
+            memcpy(buffer_ + used, input, size);
+            return;
+        }
+        memcpy(buffer_ + used, input, free);
+        transform(buffer_);
+        input += free;
+        size -= free;
+    }
+    for (; size >= 64; input += 64, size -= 64) {
+        transform(input);
+    }
+    memcpy(buffer_, input, size);
+}
+
+void Md5::update(const std::string& data) {
+    update(data.data(), data.size());
+}
+
+void Md5::update(std::istream& stream) {
+    char buffer[16 * 1024];
+    while (stream) {
+        stream.read(buffer, sizeof(buffer));
+        update(buffer, size_t(stream.gcount()));
+    }
+}
+
+void Md5::finish(unsigned char* digest) {
+    uint64_t bits = size_ * 8;
+    static const unsigned char PADDING[64] = {0x80};
+    size_t used = size_t(size_ % 64);
+    update(PADDING, used < 56 ? 56 - used : 120 - used);
+    unsigned char length[8];
+    for (int i = 0; i < 8; ++i) {
+        length[i] = (unsigned char)(bits >> (8 * i));
+    }
+    update(length, 8);
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            digest[4 * i + j] = (unsigned char)(state_[i] >> (8 * j));
+        }
+    }
+    reset();
+}
+
+std::string Md5::finish() {
+    unsigned char digest[DIGEST_SIZE];
+    finish(digest);
+    return hex_encode(digest, DIGEST_SIZE);
+}
+
+void Md5::transform(const unsigned char* block) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) {
+        m[i] = uint32_t(block[4 * i]) |
+               (uint32_t(block[4 * i + 1]) << 8) |
+               (uint32_t(block[4 * i + 2]) << 16) |
+               (uint32_t(block[4 * i + 3]) << 24);
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t f;
+        int g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        uint32_t t = d;
+        d = c;
+        c = b;
+        b = b + rotate_left(a + f + K[i] + m[g], SHIFT[i]);
+        a = t;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+}
+
+}
+
+}
+
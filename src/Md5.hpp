@@ -0,0 +1,82 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef WC_MD5_HPP_
+#define WC_MD5_HPP_
+
+#include <cstddef>
+#include <string>
+#include <iosfwd>
+#include <stdint.h>
+
+namespace Wt {
+
+namespace Wc {
+
+/** Incremental MD5 hasher.
+
+Unlike md5(), the data can be passed by parts,
+so large content (files, streams, generated output)
+can be hashed without copying it into one string:
+\code
+Md5 hasher;
+hasher.update(header);
+std::ifstream file(path.c_str(), std::ios::binary);
+hasher.update(file);
+std::string etag = hasher.finish();
+\endcode
+
+The implementation is self-contained (does not need OpenSSL or Wt),
+so this class is available regardless of WC_HAVE_MD5.
+
+\ingroup util
+*/
+class Md5 {
+public:
+    /** Size of binary digest */
+    static const int DIGEST_SIZE = 16;
+
+    /** Constructor */
+    Md5();
+
+    /** Add the data to the hash */
+    void update(const void* data, size_t size);
+
+    /** Add the data to the hash */
+    void update(const std::string& data);
+
+    /** Add the data, read from the stream until EOF, to the hash */
+    void update(std::istream& stream);
+
+    /** Finish the hashing and write binary digest to the buffer.
+    The buffer must be at least DIGEST_SIZE bytes long.
+    After this call the hasher is reset to its initial state.
+    */
+    void finish(unsigned char* digest);
+
+    /** Finish the hashing and return the digest (hex).
+    After this call the hasher is reset to its initial state.
+    */
+    std::string finish();
+
+    /** Reset the hasher to its initial state */
+    void reset();
+
+private:
+    uint32_t state_[4];
+    uint64_t size_;
+    unsigned char buffer_[64];
+
+    void transform(const unsigned char* block);
+};
+
+}
+
+}
+
+#endif
+
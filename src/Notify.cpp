@@ -96,7 +96,7 @@ void Server::emit(EventPtr event) const {
             WApplication* app = a2w.first;
             if (!direct_to_this_ || app != wApp || app == 0) {
                 const PosterAndWidgets& poster_and_widgets = a2w.second;
-                const OneAnyFunc& poster = *(poster_and_widgets.first);
+                const Poster& poster = *(poster_and_widgets.first);
                 poster(event);
             } else {
                 notify_in_this_app = true;
@@ -135,9 +135,9 @@ Server::PosterPtr Server::get_poster_ptr(WApplication* app_id) {
     PosterWeakPtr& poster_weak_ptr = a2p_[app_id];
     PosterPtr poster_ptr;
     if (poster_weak_ptr.expired()) {
-        OneAnyFunc notify = boost::bind(&Server::notify_widgets, this, _1);
-        OneAnyFunc poster = one_bound_post(notify, merge_allowed_);
-        poster_ptr = boost::make_shared<OneAnyFunc>(poster);
+        Poster notify = boost::bind(&Server::notify_widgets, this, _1);
+        Poster poster = one_bound_post<EventPtr>(notify, merge_allowed_);
+        poster_ptr = boost::make_shared<Poster>(poster);
         poster_weak_ptr = poster_ptr;
         return poster_ptr;
     } else {
@@ -211,12 +211,11 @@ void Server::stop_listening(const WidgetAndKeyList& changes) {
     }
 }
 
-void Server::notify_widgets(const boost::any& event) const {
+void Server::notify_widgets(const EventPtr& e) const {
     WidgetsSet& widgets_s = widgets_set();
     widgets_s.clear();
     mutex_.lock();
-    const EventPtr* e = boost::any_cast<EventPtr>(&event);
-    O2W::const_iterator o2w_it = o2w_.find((*e)->key());
+    O2W::const_iterator o2w_it = o2w_.find(e->key());
     if (o2w_it != o2w_.end()) {
         const A2W& a2w = o2w_it->second;
         A2W::const_iterator a2w_it = a2w.find(wApp);
@@ -233,8 +232,8 @@ void Server::notify_widgets(const boost::any& event) const {
         WidgetsSet::iterator it = widgets_s.begin();
         Widget* widget = *it;
         widgets_s.erase(it);
-        updates_needed |= widget->updates_needed(*e);
-        widget->notify(*e);
+        updates_needed |= widget->updates_needed(e);
+        widget->notify(e);
     }
     if (updates_needed && updates_enabled_) {
         updates_trigger();
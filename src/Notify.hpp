@@ -14,7 +14,6 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
-#include <boost/any.hpp>
 
 #include <Wt/WGlobal>
 
@@ -280,8 +279,9 @@ public:
     void stop_listening(const WidgetAndKeyList& changes);
 
 private:
-    typedef boost::shared_ptr<OneAnyFunc> PosterPtr;
-    typedef boost::weak_ptr<OneAnyFunc> PosterWeakPtr;
+    typedef boost::function<void(const EventPtr&)> Poster;
+    typedef boost::shared_ptr<Poster> PosterPtr;
+    typedef boost::weak_ptr<Poster> PosterWeakPtr;
     typedef std::vector<Widget*> Widgets;
     typedef std::pair<PosterPtr, Widgets> PosterAndWidgets;
     typedef std::map<WApplication*, PosterAndWidgets> A2W;
@@ -294,7 +294,7 @@ private:
     bool direct_to_this_;
     bool merge_allowed_;
 
-    void notify_widgets(const boost::any& event) const;
+    void notify_widgets(const EventPtr& event) const;
 
     PosterPtr get_poster_ptr(WApplication* app_id);
     void remove_key(Widget* widget, const Event::Key& key);
@@ -6,7 +6,14 @@
  */
 
 #include <vector>
+#include <deque>
+#include <sstream>
 #include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/unordered_map.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -17,6 +24,8 @@
 #include <Wt/WPainter>
 #include <Wt/WLineEdit>
 #include <Wt/WPushButton>
+#include <Wt/Http/Request>
+#include <Wt/Http/Response>
 
 #include "config.hpp"
 #include "global.hpp"
@@ -31,6 +40,7 @@
 #endif // WC_HAVE_WCOMPOSITEWIDGET_IMPLEMENTATION
 
 #include "PaintedCaptcha.hpp"
+#include "Executor.hpp"
 #include "rand.hpp"
 #include "util.hpp"
 
@@ -64,67 +74,267 @@ static WFont random_font() {
     return font;
 }
 
+static void curve(WPainter& painter, double x1, double y1,
+                  double x2, double y2, double x3, double y3) {
+    WPen pen(black);
+    pen.setWidth(2);
+    WPainterPath path(WPointF(x1, y1));
+    path.quadTo(x2, y2, x3, y3);
+    painter.strokePath(path, pen);
+}
+
+static void paint_key(WPaintDevice* device, const std::string& key) {
+    WPainter painter(device);
+    painter.fillRect(painter.window(), white);
+    painter.end();
+    painter.begin(device);
+    painter.setPen(black);
+    painter.setFont(random_font());
+    const double ANGLE = 5;
+    const double SCALE = 0.1;
+    const int BORDERS = 3;
+    double letter_width = WIDTH / (key.size() + BORDERS);
+    double letter_height = 2 * letter_width;
+    double x = rr(letter_width);
+    double y = drr(0, HEIGHT - letter_height);
+    std::vector<double> Xs(key.size()), Ys(key.size());
+    for (int i = 0; i < key.size(); i++) {
+        x += drr(0.8, 1.5) * letter_width;
+        y += drr(-letter_height / 2, letter_height / 2);
+        y = constrained_value(0, y, HEIGHT - letter_height);
+        Xs[i] = x + drr(0, 1) * letter_width;
+        Ys[i] = y + drr(0, 1) * letter_height;
+        painter.translate(x, y);
+        painter.rotate(drr(-ANGLE, ANGLE));
+        painter.scale(drr(1 - SCALE, 1 + SCALE), drr(1 - SCALE, 1 + SCALE));
+        painter.drawText(painter.window(), 0, key.substr(i, 1));
+        painter.resetTransform();
+    }
+    int middle = Xs.size() / 2;
+    curve(painter, Xs.front(), Ys.front(), Xs[middle], Ys[middle],
+          Xs.back(), Ys.back());
+    curve(painter, drr(0, letter_width), drr(0, HEIGHT), drr(0, WIDTH),
+          drr(0, HEIGHT), drr(WIDTH - letter_width, WIDTH), drr(0, HEIGHT));
+}
+
+static std::string random_captcha_key(int length) {
+    std::string result =  rand_string(length);
+    boost::replace_all(result, "l", "L");
+    boost::replace_all(result, "1", "L");
+    boost::replace_all(result, "o", "p");
+    boost::replace_all(result, "O", "E");
+    boost::replace_all(result, "0", "5");
+    return result;
+}
+
+typedef boost::shared_ptr<const std::string> Png;
+
+static Png render_png(const std::string& key) {
+    WRasterImage raster_image("png", WIDTH, HEIGHT);
+    paint_key(&raster_image, key);
+    std::ostringstream png;
+    raster_image.write(png);
+    return boost::make_shared<std::string>(png.str());
+}
+
+struct CaptchaPool::State {
+    struct Captcha {
+        std::string key;
+        Png png;
+    };
+
+    typedef boost::unordered_map<std::string, Png> Served;
+
+    std::deque<Captcha> ready;
+    Served served;
+    int depth;
+    int key_length;
+    int rendering;
+    bool stopped;
+    Executor* executor;
+    boost::mutex mutex;
+};
+
+typedef boost::shared_ptr<CaptchaPool::State> StatePtr;
+
+static void fill_pool(const StatePtr& state);
+
+static void render_captcha(const StatePtr& state) {
+    int key_length;
+    {
+        boost::mutex::scoped_lock lock(state->mutex);
+        key_length = state->key_length;
+    }
+    CaptchaPool::State::Captcha captcha;
+    try {
+        captcha.key = random_captcha_key(key_length);
+        captcha.png = render_png(captcha.key);
+    } catch (...) {
+        // the pool is not refilled here, take() renders missing images
+    }
+    boost::mutex::scoped_lock lock(state->mutex);
+    state->rendering -= 1;
+    if (!captcha.png) {
+        return;
+    }
+    if (key_length != state->key_length) {
+        // set_key_length() was called while rendering
+        fill_pool(state);
+    } else if (!state->stopped && int(state->ready.size()) < state->depth) {
+        state->ready.push_back(captcha);
+    }
+}
+
+static void fill_pool(const StatePtr& state) {
+    // state->mutex must be locked
+    while (!state->stopped &&
+            int(state->ready.size()) + state->rendering < state->depth) {
+        state->rendering += 1;
+        state->executor->post(boost::bind(render_captcha, state));
+    }
+}
+
+CaptchaPool::CaptchaPool(int depth, Executor* executor, WObject* parent):
+    WResource(parent), state_(new State) {
+    setDispositionType(WResource::Inline);
+    state_->depth = depth;
+    state_->key_length = 5;
+    state_->rendering = 0;
+    state_->stopped = false;
+    state_->executor = executor ? executor : &Executor::instance();
+    boost::mutex::scoped_lock lock(state_->mutex);
+    fill_pool(state_);
+}
+
+CaptchaPool::~CaptchaPool() {
+    beingDeleted();
+    // rendering threads may still use state_
+    boost::mutex::scoped_lock lock(state_->mutex);
+    state_->stopped = true;
+    state_->ready.clear();
+    state_->served.clear();
+}
+
+int CaptchaPool::depth() const {
+    boost::mutex::scoped_lock lock(state_->mutex);
+    return state_->depth;
+}
+
+void CaptchaPool::set_depth(int depth) {
+    boost::mutex::scoped_lock lock(state_->mutex);
+    state_->depth = depth;
+    while (int(state_->ready.size()) > depth) {
+        state_->ready.pop_back();
+    }
+    fill_pool(state_);
+}
+
+int CaptchaPool::key_length() const {
+    boost::mutex::scoped_lock lock(state_->mutex);
+    return state_->key_length;
+}
+
+void CaptchaPool::set_key_length(int key_length) {
+    boost::mutex::scoped_lock lock(state_->mutex);
+    state_->key_length = key_length;
+    // images with old keys are replaced
+    state_->ready.clear();
+    fill_pool(state_);
+}
+
+int CaptchaPool::size() const {
+    boost::mutex::scoped_lock lock(state_->mutex);
+    return state_->ready.size();
+}
+
+std::string CaptchaPool::take(std::string& key) {
+    State::Captcha captcha;
+    int key_length;
+    {
+        boost::mutex::scoped_lock lock(state_->mutex);
+        if (!state_->ready.empty()) {
+            captcha = state_->ready.front();
+            state_->ready.pop_front();
+        }
+        key_length = state_->key_length;
+    }
+    if (!captcha.png) {
+        // pool is exhausted
+        captcha.key = random_captcha_key(key_length);
+        captcha.png = render_png(captcha.key);
+    }
+    std::string id = rand_string();
+    {
+        boost::mutex::scoped_lock lock(state_->mutex);
+        state_->served[id] = captcha.png;
+        fill_pool(state_);
+    }
+    key = captcha.key;
+    return id;
+}
+
+std::string CaptchaPool::image_url(const std::string& id) const {
+    std::string base = url();
+    char separator = base.find('?') == std::string::npos ? '?' : '&';
+    return base + separator + "captcha=" + id;
+}
+
+void CaptchaPool::release(const std::string& id) {
+    boost::mutex::scoped_lock lock(state_->mutex);
+    state_->served.erase(id);
+}
+
+void CaptchaPool::handleRequest(const Http::Request& request,
+                                Http::Response& response) {
+    const std::string* id = request.getParameter("captcha");
+    Png png;
+    if (id) {
+        boost::mutex::scoped_lock lock(state_->mutex);
+        State::Served::const_iterator it = state_->served.find(*id);
+        if (it != state_->served.end()) {
+            png = it->second;
+        }
+    }
+    if (!png) {
+        response.setStatus(404);
+        return;
+    }
+    response.setMimeType("image/png");
+    response.out().write(png->data(), png->size());
+}
+
 class PaintedCaptcha::Impl : public WContainerWidget {
 public:
     Impl(PaintedCaptcha* captcha):
         captcha_(captcha),
-        raster_image_("png", WIDTH, HEIGHT),
-        image_(&raster_image_, /* altText */ "", this),
-        update_(0),
-        background_(white),
-        foreground_(black) {
+        raster_image_(0),
+        image_(new WImage(this)),
+        update_(0) {
         edit_ = new WLineEdit(this);
-        image_.setInline(false);
-        image_.resize(WIDTH, HEIGHT);
+        image_->setInline(false);
+        image_->resize(WIDTH, HEIGHT);
         set_buttons(true);
     }
 
     void set_key(const std::string& key) {
-        WPainter painter(&raster_image_);
-        painter.fillRect(painter.window(), background_);
-        painter.end();
-        painter.begin(&raster_image_);
-        painter.setPen(foreground_);
-        painter.setFont(random_font());
-        const double ANGLE = 5;
-        const double SCALE = 0.1;
-        const int BORDERS = 3;
-        double letter_width = WIDTH / (key.size() + BORDERS);
-        double letter_height = 2 * letter_width;
-        double x = rr(letter_width);
-        double y = drr(0, HEIGHT - letter_height);
-        std::vector<double> Xs(key.size()), Ys(key.size());
-        for (int i = 0; i < key.size(); i++) {
-            x += drr(0.8, 1.5) * letter_width;
-            y += drr(-letter_height / 2, letter_height / 2);
-            y = constrained_value(0, y, HEIGHT - letter_height);
-            Xs[i] = x + drr(0, 1) * letter_width;
-            Ys[i] = y + drr(0, 1) * letter_height;
-            painter.translate(x, y);
-            painter.rotate(drr(-ANGLE, ANGLE));
-            painter.scale(drr(1 - SCALE, 1 + SCALE), drr(1 - SCALE, 1 + SCALE));
-            painter.drawText(painter.window(), 0, key.substr(i, 1));
-            painter.resetTransform();
+        if (!raster_image_) {
+            raster_image_ = new WRasterImage("png", WIDTH, HEIGHT, this);
+            image_->setResource(raster_image_);
         }
-        int middle = Xs.size() / 2;
-        curve(painter, Xs.front(), Ys.front(), Xs[middle], Ys[middle],
-              Xs.back(), Ys.back());
-        curve(painter, drr(0, letter_width), drr(0, HEIGHT), drr(0, WIDTH),
-              drr(0, HEIGHT), drr(WIDTH - letter_width, WIDTH), drr(0, HEIGHT));
-        raster_image_.WResource::setChanged();
+        paint_key(raster_image_, key);
+        raster_image_->WResource::setChanged();
     }
 
-    std::string user_key() const {
-        return value_text(edit_).toUTF8();
+    void set_image(const std::string& url) {
+        image_->setImageRef(url);
+        if (raster_image_) {
+            delete raster_image_;
+            raster_image_ = 0;
+        }
     }
 
-    void curve(WPainter& painter, double x1, double y1, double x2, double y2,
-               double x3, double y3) {
-        WPen pen(foreground_);
-        pen.setWidth(2);
-        WPainterPath path(WPointF(x1, y1));
-        path.quadTo(x2, y2, x3, y3);
-        painter.strokePath(path, pen);
+    std::string user_key() const {
+        return value_text(edit_).toUTF8();
     }
 
     void set_buttons(bool enabled) {
@@ -148,22 +358,27 @@ public:
 
 private:
     PaintedCaptcha* captcha_;
-    WRasterImage raster_image_;
-    WImage image_;
+    WRasterImage* raster_image_;
+    WImage* image_;
     WFormWidget* edit_;
     WPushButton* update_;
-    WColor background_;
-    WColor foreground_;
 };
 
+static CaptchaPool* default_captcha_pool = 0;
+
 PaintedCaptcha::PaintedCaptcha(WContainerWidget* parent):
     AbstractCaptcha(parent),
+    pool_(default_captcha_pool),
     is_compare_trimmed_(true),
     is_compare_nocase_(true),
     key_length_(5) {
     update();
 }
 
+PaintedCaptcha::~PaintedCaptcha() {
+    release_image();
+}
+
 std::string PaintedCaptcha::user_key() const {
     PaintedCaptcha* t = const_cast<PaintedCaptcha*>(this);
     Impl* impl = 0;
@@ -186,12 +401,35 @@ void PaintedCaptcha::set_input(WFormWidget* input) {
     get_impl()->set_input(input);
 }
 
+void PaintedCaptcha::set_pool(CaptchaPool* pool) {
+    release_image();
+    pool_ = pool;
+    update();
+}
+
+CaptchaPool* PaintedCaptcha::default_pool() {
+    return default_captcha_pool;
+}
+
+void PaintedCaptcha::set_default_pool(CaptchaPool* pool) {
+    default_captcha_pool = pool;
+}
+
 void PaintedCaptcha::update_impl() {
-    true_key_ = random_key();
     if (!implementation()) {
         setImplementation(new Impl(this));
     }
-    get_impl()->set_key(true_key());
+    if (pool_) {
+        std::string old_id = image_id_;
+        image_id_ = pool_->take(true_key_);
+        get_impl()->set_image(pool_->image_url(image_id_));
+        if (!old_id.empty()) {
+            pool_->release(old_id);
+        }
+    } else {
+        true_key_ = random_key();
+        get_impl()->set_key(true_key());
+    }
 }
 
 void PaintedCaptcha::check_impl() {
@@ -203,13 +441,7 @@ void PaintedCaptcha::check_impl() {
 }
 
 std::string PaintedCaptcha::random_key() const {
-    std::string result =  rand_string(key_length());
-    boost::replace_all(result, "l", "L");
-    boost::replace_all(result, "1", "L");
-    boost::replace_all(result, "o", "p");
-    boost::replace_all(result, "O", "E");
-    boost::replace_all(result, "0", "5");
-    return result;
+    return random_captcha_key(key_length());
 }
 
 std::string PaintedCaptcha::prepare_key(const std::string& key) const {
@@ -228,6 +460,13 @@ PaintedCaptcha::Impl* PaintedCaptcha::get_impl() {
     return DOWNCAST<Impl*>(implementation());
 }
 
+void PaintedCaptcha::release_image() {
+    if (pool_ && !image_id_.empty()) {
+        pool_->release(image_id_);
+    }
+    image_id_.clear();
+}
+
 }
 
 }
@@ -8,21 +8,106 @@
 #ifndef WC_PAINTED_CAPTCHA_HPP_
 #define WC_PAINTED_CAPTCHA_HPP_
 
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include <Wt/WResource>
+
 #include "AbstractCaptcha.hpp"
 
 namespace Wt {
 
 namespace Wc {
 
+/** Server-wide pool of pre-rendered captcha images.
+
+Images (PNG) are rendered by threads of Executor
+and kept until the number of ready images reaches depth().
+take() pops a ready image, so showing a captcha costs no rendering
+on the session thread and no raster image per session.
+If the pool is empty, the image is rendered by take() itself.
+
+Taken images are served by this resource until release().
+The resource must be added to the server:
+\code
+CaptchaPool* pool = new CaptchaPool;
+WServer::instance()->addResource(pool, "/captcha.png");
+PaintedCaptcha::set_default_pool(pool);
+\endcode
+
+Methods of this class are thread-safe.
+
+\ingroup protection
+*/
+class CaptchaPool : public WResource {
+public:
+    /** Constructor.
+    \param depth Number of ready images.
+    \param executor Executor rendering images (0 means Executor::instance()).
+    \param parent Parent object.
+    */
+    CaptchaPool(int depth = 100, Executor* executor = 0, WObject* parent = 0);
+
+    /** Destructor */
+    ~CaptchaPool();
+
+    /** Return number of ready images */
+    int depth() const;
+
+    /** Set number of ready images */
+    void set_depth(int depth);
+
+    /** Return length of secret keys */
+    int key_length() const;
+
+    /** Set length of secret keys of new images.
+    Defaults to 5.
+    */
+    void set_key_length(int key_length);
+
+    /** Return number of ready (not taken) images */
+    int size() const;
+
+    /** Take an image.
+    \param key Secret key of the image (output).
+    Returns ID of the image, used by image_url() and release().
+    */
+    std::string take(std::string& key);
+
+    /** Return URL of the taken image */
+    std::string image_url(const std::string& id) const;
+
+    /** Stop serving of the taken image */
+    void release(const std::string& id);
+
+    /** Handles a request */
+    void handleRequest(const Http::Request& request, Http::Response& response);
+
+#ifndef DOXYGEN_ONLY
+    struct State;
+#endif
+
+private:
+    boost::shared_ptr<State> state_;
+};
+
 /** Captcha widget using WPaintedWidget.
 
+If \ref set_pool "a pool" is set,
+images are taken from the pool instead of being rendered by the widget.
+
 \ingroup protection
 */
 class PaintedCaptcha : public AbstractCaptcha {
 public:
-    /** Constructor */
+    /** Constructor.
+    The \ref default_pool "default pool" is used, if set.
+    */
     PaintedCaptcha(WContainerWidget* parent = 0);
 
+    /** Destructor */
+    ~PaintedCaptcha();
+
     /** Randomly created secret key.
     The purpose of user is to guess this key.
     */
@@ -64,9 +149,28 @@ public:
 
     /** Set secret key length and update secret key.
     Defaults to 5.
+    If the pool is used, key length of the pool is used instead.
     */
     void set_key_length(int key_length);
 
+    /** Return pool of pre-rendered images (may be 0) */
+    CaptchaPool* pool() const {
+        return pool_;
+    }
+
+    /** Set pool of pre-rendered images and update secret key.
+    If 0, the image is rendered by the widget.
+    */
+    void set_pool(CaptchaPool* pool);
+
+    /** Return pool used by new captchas (defaults to 0) */
+    static CaptchaPool* default_pool();
+
+    /** Set pool used by new captchas.
+    The pool must not be deleted while it is used by captchas.
+    */
+    static void set_default_pool(CaptchaPool* pool);
+
     /** Enable or disable update button */
     void set_buttons(bool enabled);
 
@@ -84,12 +188,15 @@ private:
     class Impl;
 
     std::string true_key_;
+    CaptchaPool* pool_;
+    std::string image_id_;
     bool is_compare_trimmed_: 1;
     bool is_compare_nocase_: 1;
     int key_length_;
 
     std::string prepare_key(const std::string& key) const;
     Impl* get_impl();
+    void release_image();
 };
 
 }
@@ -16,6 +16,7 @@
 #include <boost/thread/tss.hpp>
 
 #include "Planning.hpp"
+#include "Executor.hpp"
 #include "util.hpp"
 #include "config.hpp"
 
@@ -115,6 +116,10 @@ void PlanningServer::set_scheduler(const Scheduler& scheduler) {
     scheduler_ = scheduler;
 }
 
+void PlanningServer::set_executor(Executor* executor) {
+    set_scheduler(boost::bind(&Executor::schedule, executor, _1, _2));
+}
+
 #ifdef WC_HAVE_WIOSERVICE
 WIOService* PlanningServer::io_service() {
 #if USE_WIOSERVICE
@@ -173,6 +173,13 @@ public:
     */
     void set_scheduler(const Scheduler& scheduler);
 
+    /** Use the executor to apply tasks.
+    This is a method for convenience, calling set_scheduler().
+
+    \note The ownership of the executor is not transferred.
+    */
+    void set_executor(Executor* executor);
+
 #ifdef WC_HAVE_WIOSERVICE
     /** Get IO service.
     \deprecated Return WIOService, used for Wt server, if available, else 0.
@@ -0,0 +1,194 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include <algorithm>
+#include <boost/asio/ip/address.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Wt/WApplication>
+#include <Wt/WEnvironment>
+
+#include "RateLimiter.hpp"
+#include "util.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+struct RateLimiter::Bucket {
+    double tokens;
+    long long updated; // microseconds
+    const std::string* key;
+    // list of buckets of the shard, ordered by updated
+    Bucket* prev;
+    Bucket* next;
+};
+
+struct RateLimiter::Shard {
+    typedef boost::unordered_map<std::string, Bucket> Map;
+    Map map;
+    Bucket* first;
+    Bucket* last;
+    boost::mutex mutex;
+
+    Shard():
+        first(0), last(0)
+    { }
+
+    void unlink(Bucket* bucket) {
+        (bucket->prev ? bucket->prev->next : first) = bucket->next;
+        (bucket->next ? bucket->next->prev : last) = bucket->prev;
+    }
+
+    void append(Bucket* bucket) {
+        bucket->prev = last;
+        bucket->next = 0;
+        (last ? last->next : first) = bucket;
+        last = bucket;
+    }
+};
+
+// max number of idle buckets removed by one call of allow()
+const int REMOVE_STEP = 4;
+
+static long long now_microseconds() {
+    using namespace boost::posix_time;
+    static const ptime epoch(boost::gregorian::date(2000, 1, 1));
+    return (microsec_clock::universal_time() - epoch).total_microseconds();
+}
+
+RateLimiter::RateLimiter(double rate, double burst):
+    shards_(new Shard[SHARDS_NUMBER]),
+    rate_(rate), burst_(burst),
+    ipv4_prefix_(32), ipv6_prefix_(64)
+{ }
+
+RateLimiter::~RateLimiter() {
+    delete[] shards_;
+    shards_ = 0;
+}
+
+void RateLimiter::set_prefixes(int ipv4_prefix, int ipv6_prefix) {
+    ipv4_prefix_ = ipv4_prefix;
+    ipv6_prefix_ = ipv6_prefix;
+}
+
+bool RateLimiter::allow(const std::string& key, double cost) {
+    long long now = now_microseconds();
+    Shard& shard = shard_of(key);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    remove_idle(shard, now);
+    Shard::Map::iterator it = shard.map.find(key);
+    Bucket* bucket;
+    if (it == shard.map.end()) {
+        it = shard.map.insert(Shard::Map::value_type(key, Bucket())).first;
+        bucket = &it->second;
+        bucket->tokens = burst_;
+        bucket->key = &it->first;
+    } else {
+        bucket = &it->second;
+        // clock can go back
+        long long elapsed = std::max(now - bucket->updated, 0LL);
+        bucket->tokens = std::min(burst_,
+                                  bucket->tokens + elapsed * rate_ / 1e6);
+        shard.unlink(bucket);
+    }
+    bucket->updated = now;
+    shard.append(bucket);
+    if (bucket->tokens >= cost) {
+        bucket->tokens -= cost;
+        return true;
+    }
+    return false;
+}
+
+bool RateLimiter::allow_address(const std::string& address, double cost) {
+    return allow(address_key(address), cost);
+}
+
+bool RateLimiter::allow_client(double cost) {
+    return allow_address(wApp->environment().clientAddress(), cost);
+}
+
+template<typename Bytes>
+static void apply_prefix(Bytes& bytes, int prefix) {
+    for (int i = 0; i < int(bytes.size()); ++i) {
+        int bits = std::min(std::max(prefix - 8 * i, 0), 8);
+        bytes[i] &= (unsigned char)(0xFF00 >> bits);
+    }
+}
+
+std::string RateLimiter::address_key(const std::string& address) const {
+    namespace ip = boost::asio::ip;
+    boost::system::error_code error;
+    ip::address a = ip::address::from_string(address, error);
+    if (error) {
+        return address;
+    }
+    if (a.is_v6() && !a.to_v6().is_v4_mapped()) {
+        ip::address_v6::bytes_type bytes = a.to_v6().to_bytes();
+        apply_prefix(bytes, ipv6_prefix_);
+        return ip::address_v6(bytes).to_string() + "/" + TO_S(ipv6_prefix_);
+    }
+    ip::address_v4 v4 = a.is_v4() ? a.to_v4() : a.to_v6().to_v4();
+    if (ipv4_prefix_ >= 32) {
+        return v4.to_string();
+    }
+    ip::address_v4::bytes_type bytes = v4.to_bytes();
+    apply_prefix(bytes, ipv4_prefix_);
+    return ip::address_v4(bytes).to_string() + "/" + TO_S(ipv4_prefix_);
+}
+
+int RateLimiter::size() const {
+    int result = 0;
+    for (int i = 0; i < SHARDS_NUMBER; ++i) {
+        boost::mutex::scoped_lock lock(shards_[i].mutex);
+        result += shards_[i].map.size();
+    }
+    return result;
+}
+
+void RateLimiter::clear() {
+    for (int i = 0; i < SHARDS_NUMBER; ++i) {
+        Shard& shard = shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        shard.map.clear();
+        shard.first = shard.last = 0;
+    }
+}
+
+RateLimiter::Shard& RateLimiter::shard_of(const std::string& key) {
+    size_t hash = boost::hash_range(key.begin(), key.end());
+    // low bits of hash are used by buckets of unordered_map
+    return shards_[(hash >> 16) % SHARDS_NUMBER];
+}
+
+void RateLimiter::remove_idle(Shard& shard, long long now) {
+    // shard.mutex must be locked
+    for (int i = 0; i < REMOVE_STEP && shard.first; ++i) {
+        Bucket* bucket = shard.first;
+        if (!is_idle(*bucket, now)) {
+            // other buckets were updated later
+            break;
+        }
+        shard.unlink(bucket);
+        shard.map.erase(shard.map.find(*bucket->key));
+    }
+}
+
+bool RateLimiter::is_idle(const Bucket& bucket, long long now) const {
+    return bucket.tokens + (now - bucket.updated) * rate_ / 1e6 >= burst_;
+}
+
+}
+
+}
+
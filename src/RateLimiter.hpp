@@ -0,0 +1,141 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef WC_RATE_LIMITER_HPP_
+#define WC_RATE_LIMITER_HPP_
+
+#include <string>
+
+namespace Wt {
+
+namespace Wc {
+
+/** Thread-safe limiter of frequency of actions per key (e.g., per IP).
+
+Each key has a token bucket of size burst().
+The bucket is refilled with rate() tokens per second,
+an action takes tokens from the bucket.
+An action is allowed if the bucket has enough tokens.
+
+Keys are distributed among shards, each protected by its own mutex.
+Buckets which became full (i.e., equivalent to absent ones) are removed
+incrementally by calls of allow(), so there are no long pauses
+caused by removing of old entries.
+
+Client addresses are aggregated by network prefix (see allow_address()),
+since a client usually owns whole IPv6 network /64.
+
+Example: allow 10 tasks per minute from a client (Wbi):
+\code
+RateLimiter limiter(10.0 / 60, 10);
+task->set_validator(boost::bind(&RateLimiter::allow_client, &limiter, 1.0));
+\endcode
+
+Rate and burst should be set before the limiter is used by several threads.
+
+\ingroup protection
+*/
+class RateLimiter {
+public:
+    /** Constructor.
+    \param rate Number of tokens added to a bucket per second.
+    \param burst Max number of tokens in a bucket.
+    */
+    RateLimiter(double rate = 1.0, double burst = 1.0);
+
+    /** Destructor */
+    virtual ~RateLimiter();
+
+    /** Return number of tokens added to a bucket per second */
+    double rate() const {
+        return rate_;
+    }
+
+    /** Set number of tokens added to a bucket per second */
+    void set_rate(double rate) {
+        rate_ = rate;
+    }
+
+    /** Return max number of tokens in a bucket */
+    double burst() const {
+        return burst_;
+    }
+
+    /** Set max number of tokens in a bucket */
+    void set_burst(double burst) {
+        burst_ = burst;
+    }
+
+    /** Return length of network prefix of IPv4 addresses (defaults to 32) */
+    int ipv4_prefix() const {
+        return ipv4_prefix_;
+    }
+
+    /** Return length of network prefix of IPv6 addresses (defaults to 64) */
+    int ipv6_prefix() const {
+        return ipv6_prefix_;
+    }
+
+    /** Set lengths of network prefixes used by address_key() */
+    void set_prefixes(int ipv4_prefix, int ipv6_prefix);
+
+    /** Try to take \p cost tokens from bucket of the key.
+    Returns if the action is allowed.
+    If not, tokens are not taken.
+    */
+    bool allow(const std::string& key, double cost = 1.0);
+
+    /** Try to take \p cost tokens from bucket of the address.
+    The address is converted to a key by address_key().
+    */
+    bool allow_address(const std::string& address, double cost = 1.0);
+
+    /** Try to take \p cost tokens from bucket of current client.
+    Address of the client is taken from WEnvironment of wApp.
+    */
+    bool allow_client(double cost = 1.0);
+
+    /** Return key of network of the address.
+    Bits of the address after the prefix are set to zero.
+    IPv4-mapped IPv6 addresses are handled as IPv4 addresses.
+    If the address can not be parsed, it is returned as is.
+    */
+    std::string address_key(const std::string& address) const;
+
+    /** Return number of stored buckets */
+    int size() const;
+
+    /** Remove all buckets */
+    void clear();
+
+#ifndef DOXYGEN_ONLY
+    struct Bucket;
+    struct Shard;
+#endif
+
+private:
+    static const int SHARDS_NUMBER = 16;
+    Shard* shards_;
+    double rate_;
+    double burst_;
+    int ipv4_prefix_;
+    int ipv6_prefix_;
+
+    Shard& shard_of(const std::string& key);
+    void remove_idle(Shard& shard, long long now);
+    bool is_idle(const Bucket& bucket, long long now) const;
+
+    RateLimiter(const RateLimiter&);
+    RateLimiter& operator=(const RateLimiter&);
+};
+
+}
+
+}
+
+#endif
+
@@ -8,6 +8,10 @@
 #include "config.hpp"
 #include "global.hpp"
 
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/once.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
 #include <Wt/WConfig.h>
@@ -22,6 +26,8 @@
 #include <Wt/WText>
 #include <Wt/Http/Client>
 #include <Wt/Http/Message>
+#include <Wt/Http/Request>
+#include <Wt/Http/Response>
 
 #ifndef WC_HAVE_WCOMPOSITEWIDGET_IMPLEMENTATION
 // FIXME nasty public morozov
@@ -38,11 +44,275 @@ namespace Wt {
 
 namespace Wc {
 
+struct RecaptchaVerifier::Request {
+    std::string key;
+    std::string body;
+    std::vector<Handler> handlers;
+};
+
+RecaptchaVerifier::RecaptchaVerifier():
+#ifdef WT_WITH_SSL
+    url_("https://www.google.com/recaptcha/api/verify"),
+#else
+    url_("http://www.google.com/recaptcha/api/verify"),
+#endif
+    max_in_flight_(16),
+    max_queue_(256),
+    timeout_(10 * td::SECOND),
+    cache_ttl_(td::MINUTE),
+    in_flight_(0)
+{ }
+
+RecaptchaVerifier::~RecaptchaVerifier() {
+    BOOST_FOREACH (Request* request, queue_) {
+        delete request;
+    }
+}
+
+static RecaptchaVerifier* default_verifier = 0;
+static boost::once_flag default_verifier_once = BOOST_ONCE_INIT;
+
+static void create_default_verifier() {
+    static RecaptchaVerifier verifier;
+    default_verifier = &verifier;
+}
+
+RecaptchaVerifier& RecaptchaVerifier::instance() {
+    boost::call_once(default_verifier_once, create_default_verifier);
+    return *default_verifier;
+}
+
+std::string RecaptchaVerifier::url() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return url_;
+}
+
+void RecaptchaVerifier::set_url(const std::string& url) {
+    boost::mutex::scoped_lock lock(mutex_);
+    url_ = url;
+}
+
+int RecaptchaVerifier::max_in_flight() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_in_flight_;
+}
+
+void RecaptchaVerifier::set_max_in_flight(int max_in_flight) {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_in_flight_ = max_in_flight;
+}
+
+int RecaptchaVerifier::max_queue() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_queue_;
+}
+
+void RecaptchaVerifier::set_max_queue(int max_queue) {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_queue_ = max_queue;
+}
+
+td::TimeDuration RecaptchaVerifier::timeout() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return timeout_;
+}
+
+void RecaptchaVerifier::set_timeout(const td::TimeDuration& timeout) {
+    boost::mutex::scoped_lock lock(mutex_);
+    timeout_ = timeout;
+}
+
+td::TimeDuration RecaptchaVerifier::cache_ttl() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return cache_ttl_;
+}
+
+void RecaptchaVerifier::set_cache_ttl(const td::TimeDuration& cache_ttl) {
+    boost::mutex::scoped_lock lock(mutex_);
+    cache_ttl_ = cache_ttl;
+}
+
+void RecaptchaVerifier::verify(const std::string& private_key,
+                               const std::string& remoteip,
+                               const std::string& challenge,
+                               const std::string& response,
+                               const Handler& handler) {
+    std::string key = private_key + '\x01' + challenge + '\x01' + response;
+    Request* start = 0;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        remove_expired(boost::posix_time::microsec_clock::universal_time());
+        Cache::const_iterator cached = cache_.find(key);
+        if (cached != cache_.end()) {
+            Result result = cached->second.result;
+            lock.unlock();
+            handler(result);
+            return;
+        }
+        Requests::iterator it = requests_.find(key);
+        if (it != requests_.end()) {
+            // same check is in progress
+            it->second->handlers.push_back(handler);
+            return;
+        }
+        if (in_flight_ >= max_in_flight_ && int(queue_.size()) >= max_queue_) {
+            lock.unlock();
+            handler(FAILED);
+            return;
+        }
+        Request* request = new Request;
+        request->key = key;
+        request->body = "privatekey=" + urlencode(private_key) +
+                        "&remoteip=" + urlencode(remoteip) +
+                        "&challenge=" + urlencode(challenge) +
+                        "&response=" + urlencode(response);
+        request->handlers.push_back(handler);
+        requests_[key] = request;
+        if (in_flight_ < max_in_flight_) {
+            in_flight_ += 1;
+            start = request;
+        } else {
+            queue_.push_back(request);
+        }
+    }
+    if (start) {
+        send(start);
+    }
+}
+
+int RecaptchaVerifier::in_flight() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return in_flight_;
+}
+
+int RecaptchaVerifier::queued() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return queue_.size();
+}
+
+static void delete_client(Http::Client* client) {
+    delete client;
+}
+
+void RecaptchaVerifier::send(Request* request) {
+    WServer* server = WServer::instance();
+    if (!server) {
+        finish(request, FAILED);
+        return;
+    }
+    std::string url;
+    int timeout;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        url = url_;
+        timeout = std::max(1, int(timeout_.total_seconds()));
+    }
+    // not bound to any application
+    Http::Client* client = new Http::Client(server->ioService());
+    client->setTimeout(timeout);
+    client->setMaximumResponseSize(1024);
+    client->done().connect(boost::bind(&RecaptchaVerifier::done, this,
+                                       request, client, _1, _2));
+    Http::Message m;
+    m.setHeader("Content-Type", "application/x-www-form-urlencoded");
+    m.addBodyText(request->body);
+    if (!client->post(url, m)) {
+        delete client;
+        finish(request, FAILED);
+    }
+}
+
+void RecaptchaVerifier::done(Request* request, Http::Client* client,
+                             const boost::system::error_code& e,
+                             const Http::Message& message) {
+    // the client can not be deleted from its own signal
+    WServer::instance()->ioService().post(boost::bind(delete_client, client));
+    Result result;
+    if (e || message.status() != 200) {
+        result = FAILED;
+    } else if (boost::starts_with(message.body(), "true")) {
+        result = CORRECT;
+    } else if (boost::contains(message.body(), "incorrect-captcha-sol")) {
+        result = WRONG;
+    } else {
+        result = FAILED;
+    }
+    finish(request, result);
+}
+
+void RecaptchaVerifier::finish(Request* request, Result result) {
+    Request* next = 0;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        requests_.erase(request->key);
+        // a correct response is accepted once, see verify()
+        if (result == WRONG && cache_ttl_ > td::TD_NULL) {
+            CachedResult& cached = cache_[request->key];
+            cached.result = result;
+            cached.expires = boost::posix_time::microsec_clock::universal_time()
+                             + cache_ttl_;
+            cache_order_.push_back(request->key);
+        }
+        if (!queue_.empty()) {
+            next = queue_.front();
+            queue_.pop_front();
+        } else {
+            in_flight_ -= 1;
+        }
+    }
+    BOOST_FOREACH (const Handler& handler, request->handlers) {
+        handler(result);
+        if (result == CORRECT) {
+            // other checks of the same response are repetitions
+            result = WRONG;
+        }
+    }
+    delete request;
+    if (next) {
+        send(next);
+    }
+}
+
+void RecaptchaVerifier::remove_expired(const boost::posix_time::ptime& now) {
+    // mutex_ must be locked
+    while (!cache_order_.empty()) {
+        Cache::iterator it = cache_.find(cache_order_.front());
+        if (it != cache_.end()) {
+            if (it->second.expires > now) {
+                break;
+            }
+            cache_.erase(it);
+        }
+        cache_order_.pop_front();
+    }
+}
+
+RecaptchaStubResource::RecaptchaStubResource(
+    const std::string& correct_response, WObject* parent):
+    WResource(parent), correct_response_(correct_response)
+{ }
+
+RecaptchaStubResource::~RecaptchaStubResource() {
+    beingDeleted();
+}
+
+void RecaptchaStubResource::handleRequest(const Http::Request& request,
+        Http::Response& response) {
+    response.setMimeType("text/plain");
+    const std::string* r = request.getParameter("response");
+    if (r && *r == correct_response_) {
+        response.out() << "true\nsuccess";
+    } else {
+        response.out() << "false\nincorrect-captcha-sol";
+    }
+}
+
 Recaptcha::Recaptcha(const std::string& public_key,
                      const std::string& private_key,
                      WContainerWidget* parent):
     AbstractCaptcha(parent),
     buttons_enabled_(true),
+    alive_(new bool(true)),
     public_key_(public_key),
     private_key_(private_key),
     input_(0),
@@ -51,12 +321,11 @@ Recaptcha::Recaptcha(const std::string& public_key,
     wApp->enableUpdates();
     wApp->require("https://www.google.com/recaptcha/api/js/recaptcha_ajax.js",
                   "Recaptcha");
-    http_ = new Http::Client(this);
-    http_->done().connect(this, &Recaptcha::http_done);
     update_impl();
 }
 
 Recaptcha::~Recaptcha() {
+    *alive_ = false;
     doJavaScript("Recaptcha.destroy();");
     doJavaScript("clearTimeout($(" + jsRef() + ").data('timer'));");
 }
@@ -128,20 +397,12 @@ void Recaptcha::check_impl() {
     std::string challenge = value_text(challenge_field_).toUTF8();
     std::string response = value_text(response_field_).toUTF8();
     const std::string& remoteip = wApp->environment().clientAddress();
-    Http::Message m;
-    m.setHeader("Content-Type", "application/x-www-form-urlencoded");
-    m.addBodyText("privatekey=" + private_key_ + "&");
-    m.addBodyText("remoteip=" + remoteip + "&");
-    m.addBodyText("challenge=" + urlencode(challenge) + "&");
-    m.addBodyText("response=" + urlencode(response) + "&");
-#ifdef WT_WITH_SSL
-    std::string schema = "https";
-#else
-    std::string schema = "http";
-#endif
-    if (!http_->post(schema + "://www.google.com/recaptcha/api/verify", m)) {
-        mistake(tr("wc.captcha.Internal_error"));
-    }
+    RecaptchaVerifier::Handler handler =
+        one_bound_post<RecaptchaVerifier::Result>(boost::bind(
+                    &Recaptcha::verified_handler, alive_, this, _1),
+                /* allow_merge */ false);
+    RecaptchaVerifier::instance().verify(private_key_, remoteip,
+                                         challenge, response, handler);
 }
 
 bool Recaptcha::js() const {
@@ -152,18 +413,23 @@ WContainerWidget* Recaptcha::get_impl() {
     return DOWNCAST<WContainerWidget*>(implementation());
 }
 
-void Recaptcha::http_done(const boost::system::error_code& e,
-                          const Http::Message& response) {
-    if (e) {
-        mistake(tr("wc.captcha.Internal_error"));
-    } else if (boost::starts_with(response.body(), "true")) {
+void Recaptcha::verified(RecaptchaVerifier::Result result) {
+    if (result == RecaptchaVerifier::CORRECT) {
         solve();
-    } else if (boost::contains(response.body(), "incorrect-captcha-sol")) {
+    } else if (result == RecaptchaVerifier::WRONG) {
         mistake(tr("wc.captcha.Wrong_response"));
     } else {
         mistake(tr("wc.captcha.Internal_error"));
     }
-    updates_poster(WServer::instance(), wApp);
+    updates_trigger();
+}
+
+void Recaptcha::verified_handler(const boost::shared_ptr<bool>& alive,
+                                 Recaptcha* captcha,
+                                 RecaptchaVerifier::Result result) {
+    if (*alive) {
+        captcha->verified(result);
+    }
 }
 
 void Recaptcha::add_buttons() {
@@ -8,21 +8,204 @@
 #ifndef WC_RECAPTCHA_HPP_
 #define WC_RECAPTCHA_HPP_
 
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/system/error_code.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include <Wt/WGlobal>
+#include <Wt/WResource>
 
 #include "AbstractCaptcha.hpp"
+#include "TimeDuration.hpp"
 #include "config.hpp"
 
 namespace Wt {
 
 namespace Wc {
 
+/** Process-wide client verifying reCAPTCHA responses.
+
+All Recaptcha widgets pass their checks to instance(), which:
+ - limits number of simultaneous HTTP requests (max_in_flight());
+   other checks wait in the queue of size max_queue(),
+   if it is full, the check fails at once;
+ - sends one request for identical checks made simultaneously;
+ - stops requests after timeout();
+ - remembers wrong responses for cache_ttl(),
+   so repeated checks of the same response do not cause requests.
+
+A correct response is accepted once, as reCAPTCHA API does.
+It is never remembered: if identical checks are made simultaneously,
+only one of them is passed CORRECT, others are passed WRONG.
+
+Wt::Http::Client closes the connection after each response,
+so limiting the number of requests in flight is what
+bounds the number of sockets.
+
+To test the whole path offline, add RecaptchaStubResource to the server
+and direct the verifier to it:
+\code
+WServer::instance()->addResource(new RecaptchaStubResource, "/verify");
+RecaptchaVerifier::instance().set_url("http://127.0.0.1:8080/verify");
+\endcode
+
+Methods of this class are thread-safe.
+
+\ingroup protection
+*/
+class RecaptchaVerifier {
+public:
+    /** Result of verification */
+    enum Result {
+        CORRECT, /**< The response is correct */
+        WRONG, /**< The response is wrong */
+        FAILED /**< Error (network, timeout, overload, etc) */
+    };
+
+    /** Function called with result of verification */
+    typedef boost::function<void(Result)> Handler;
+
+    /** Constructor */
+    RecaptchaVerifier();
+
+    /** Destructor */
+    virtual ~RecaptchaVerifier();
+
+    /** Return default verifier */
+    static RecaptchaVerifier& instance();
+
+    /** Return URL of verification API */
+    std::string url() const;
+
+    /** Set URL of verification API.
+    Defaults to http(s)://www.google.com/recaptcha/api/verify.
+    */
+    void set_url(const std::string& url);
+
+    /** Return max number of simultaneous requests */
+    int max_in_flight() const;
+
+    /** Set max number of simultaneous requests (defaults to 16) */
+    void set_max_in_flight(int max_in_flight);
+
+    /** Return max number of checks waiting for a request */
+    int max_queue() const;
+
+    /** Set max number of checks waiting for a request (defaults to 256) */
+    void set_max_queue(int max_queue);
+
+    /** Return timeout of a request */
+    td::TimeDuration timeout() const;
+
+    /** Set timeout of a request (defaults to 10 seconds).
+    The precision is 1 second.
+    */
+    void set_timeout(const td::TimeDuration& timeout);
+
+    /** Return time during which wrong responses are remembered */
+    td::TimeDuration cache_ttl() const;
+
+    /** Set time during which wrong responses are remembered.
+    Defaults to 1 minute.
+    TD_NULL disables the cache.
+    */
+    void set_cache_ttl(const td::TimeDuration& cache_ttl);
+
+    /** Verify the response.
+    The handler is called once, from any thread
+    (possibly from this method).
+    Use bound_post() to handle the result in the application.
+    */
+    void verify(const std::string& private_key, const std::string& remoteip,
+                const std::string& challenge, const std::string& response,
+                const Handler& handler);
+
+    /** Return number of requests in flight */
+    int in_flight() const;
+
+    /** Return number of checks waiting for a request */
+    int queued() const;
+
+#ifndef DOXYGEN_ONLY
+    struct Request;
+#endif
+
+private:
+    struct CachedResult {
+        Result result;
+        boost::posix_time::ptime expires;
+    };
+
+    typedef std::map<std::string, CachedResult> Cache;
+    typedef std::map<std::string, Request*> Requests;
+
+    std::string url_;
+    int max_in_flight_;
+    int max_queue_;
+    td::TimeDuration timeout_;
+    td::TimeDuration cache_ttl_;
+    int in_flight_;
+    std::deque<Request*> queue_;
+    Requests requests_;
+    Cache cache_;
+    // keys of cache_ in order of addition
+    std::deque<std::string> cache_order_;
+    mutable boost::mutex mutex_;
+
+    void send(Request* request);
+    void done(Request* request, Http::Client* client,
+              const boost::system::error_code& e,
+              const Http::Message& message);
+    void finish(Request* request, Result result);
+    void remove_expired(const boost::posix_time::ptime& now);
+
+    RecaptchaVerifier(const RecaptchaVerifier&);
+    RecaptchaVerifier& operator=(const RecaptchaVerifier&);
+};
+
+/** Local stand-in for reCAPTCHA verification API.
+Answers as the real API does: the response is considered correct
+if it is equal to correct_response().
+
+This resource is intended for load testing without access to
+the Internet, see RecaptchaVerifier.
+
+\ingroup protection
+*/
+class RecaptchaStubResource : public WResource {
+public:
+    /** Constructor */
+    RecaptchaStubResource(const std::string& correct_response = "correct",
+                          WObject* parent = 0);
+
+    /** Destructor */
+    ~RecaptchaStubResource();
+
+    /** Return correct response */
+    const std::string& correct_response() const {
+        return correct_response_;
+    }
+
+    /** Handles a request */
+    void handleRequest(const Http::Request& request, Http::Response& response);
+
+private:
+    std::string correct_response_;
+};
+
 /** reCAPTCHA widget.
 To use this class, you should provide keys for Recaptcha API.
 These keys can be generated on http://www.google.com/recaptcha
 
+Responses are verified by RecaptchaVerifier::instance().
+
 \note Multiple instances of Recaptcha on same page are not allowed.
 
 <h3>CSS</h3>
@@ -63,7 +246,8 @@ protected:
 
 private:
     bool buttons_enabled_;
-    Http::Client* http_;
+    // false after destruction; results may come later
+    boost::shared_ptr<bool> alive_;
     std::string public_key_;
     std::string private_key_;
     WFormWidget* input_;
@@ -72,8 +256,10 @@ private:
 
     bool js() const;
     WContainerWidget* get_impl();
-    void http_done(const boost::system::error_code& e,
-                   const Http::Message& message);
+    void verified(RecaptchaVerifier::Result result);
+    static void verified_handler(const boost::shared_ptr<bool>& alive,
+                                 Recaptcha* captcha,
+                                 RecaptchaVerifier::Result result);
     void add_buttons();
 };
 
@@ -0,0 +1,753 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#include "config.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <boost/any.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string/replace.hpp>
+
+#include <Wt/WServer>
+#include <Wt/Http/Client>
+#include <Wt/Http/Message>
+#include <Wt/Http/Request>
+#include <Wt/Http/Response>
+#include <Wt/Http/ResponseContinuation>
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+#include <Wt/Utils>
+#include <Wt/WColor>
+#include <Wt/WPainter>
+#include <Wt/WPointF>
+#include <Wt/WRasterImage>
+#include <Wt/WRectF>
+#endif
+
+#include "TileResource.hpp"
+#include "Executor.hpp"
+#include "rand.hpp"
+#include "util.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+struct TileResource::Fetch {
+    std::string key;
+    int z, x, y;
+    std::vector<TileHandler> handlers;
+};
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+struct TileResource::Viewport {
+    int z;
+    int left, top; // pixel of the map at top left corner
+    int width, height;
+    int x0, y0; // tile at top left corner (x0 may be out of the map)
+    int columns, rows;
+    std::vector<Tile> tiles; // row by row
+    int pending; // number of tiles being fetched
+};
+#endif
+
+// coordinates of tiles must fit int
+const int MAX_ZOOM = 30;
+const int MAX_TILE_SIZE = 1024 * 1024;
+const int TILE_SIZE = 256;
+// pixel coordinates must fit int
+const int MAX_VIEWPORT_ZOOM = 22;
+const int MAX_VIEWPORT_SIZE = 2048;
+const int VIEWPORT_GRID = 64;
+// memory used by a cached tile besides its data
+const size_t TILE_OVERHEAD = 128;
+
+TileResource::TileResource(const std::string& url_template, WObject* parent):
+    WResource(parent),
+    url_template_(url_template),
+    max_zoom_(19),
+    max_in_flight_(16),
+    max_queue_(256),
+    failure_ttl_(30 * td::SECOND),
+    timeout_(10 * td::SECOND),
+    tiles_(32 * 1024 * 1024),
+    viewports_(8 * 1024 * 1024),
+    in_flight_(0),
+    upstream_requests_(0) {
+    setDispositionType(WResource::Inline);
+}
+
+TileResource::~TileResource() {
+    beingDeleted();
+}
+
+std::string TileResource::url_template() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return url_template_;
+}
+
+void TileResource::set_url_template(const std::string& url_template) {
+    boost::mutex::scoped_lock lock(mutex_);
+    url_template_ = url_template;
+}
+
+std::string TileResource::cache_dir() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return cache_dir_;
+}
+
+void TileResource::set_cache_dir(const std::string& cache_dir) {
+    boost::mutex::scoped_lock lock(mutex_);
+    cache_dir_ = cache_dir;
+}
+
+size_t TileResource::max_memory() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return tiles_.max_size;
+}
+
+void TileResource::set_max_memory(size_t max_memory) {
+    boost::mutex::scoped_lock lock(mutex_);
+    tiles_.max_size = max_memory;
+    tiles_.shrink();
+}
+
+size_t TileResource::max_viewport_memory() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return viewports_.max_size;
+}
+
+void TileResource::set_max_viewport_memory(size_t max_viewport_memory) {
+    boost::mutex::scoped_lock lock(mutex_);
+    viewports_.max_size = max_viewport_memory;
+    viewports_.shrink();
+}
+
+int TileResource::max_zoom() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_zoom_;
+}
+
+void TileResource::set_max_zoom(int max_zoom) {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_zoom_ = std::min(max_zoom, MAX_ZOOM);
+}
+
+int TileResource::max_in_flight() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_in_flight_;
+}
+
+void TileResource::set_max_in_flight(int max_in_flight) {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_in_flight_ = max_in_flight;
+}
+
+int TileResource::max_queue() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_queue_;
+}
+
+void TileResource::set_max_queue(int max_queue) {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_queue_ = max_queue;
+}
+
+td::TimeDuration TileResource::failure_ttl() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return failure_ttl_;
+}
+
+void TileResource::set_failure_ttl(const td::TimeDuration& failure_ttl) {
+    boost::mutex::scoped_lock lock(mutex_);
+    failure_ttl_ = failure_ttl;
+}
+
+td::TimeDuration TileResource::timeout() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return timeout_;
+}
+
+void TileResource::set_timeout(const td::TimeDuration& timeout) {
+    boost::mutex::scoped_lock lock(mutex_);
+    timeout_ = timeout;
+}
+
+std::string TileResource::tile_url(int z, int x, int y) const {
+    std::string base = url();
+    char separator = base.find('?') == std::string::npos ? '?' : '&';
+    return base + separator + "z=" + TO_S(z) + "&x=" + TO_S(x) +
+           "&y=" + TO_S(y);
+}
+
+std::string TileResource::tile_url_template() const {
+    std::string base = url();
+    char separator = base.find('?') == std::string::npos ? '?' : '&';
+    return base + separator + "z=${z}&x=${x}&y=${y}";
+}
+
+static std::string tile_key(int z, int x, int y) {
+    return TO_S(z) + "/" + TO_S(x) + "/" + TO_S(y);
+}
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+std::string TileResource::viewport_url(int z, int center_x, int center_y,
+                                       int width, int height) const {
+    std::string base = url();
+    char separator = base.find('?') == std::string::npos ? '?' : '&';
+    return base + separator + "z=" + TO_S(z) +
+           "&cx=" + TO_S(center_x) + "&cy=" + TO_S(center_y) +
+           "&w=" + TO_S(width) + "&h=" + TO_S(height);
+}
+
+static int snap(int value) {
+    int half = VIEWPORT_GRID / 2;
+    int shifted = value >= 0 ? value + half : value - half + 1;
+    return shifted / VIEWPORT_GRID * VIEWPORT_GRID;
+}
+
+static int round_up(int size) {
+    return (size + VIEWPORT_GRID - 1) / VIEWPORT_GRID * VIEWPORT_GRID;
+}
+
+void TileResource::snap_viewport(int& center_x, int& center_y,
+                                 int& width, int& height) {
+    // the center moves by up to VIEWPORT_GRID / 2 in each direction
+    center_x = snap(center_x);
+    center_y = snap(center_y);
+    width = round_up(width) + VIEWPORT_GRID;
+    height = round_up(height) + VIEWPORT_GRID;
+}
+#endif
+
+TileResource::Tile TileResource::cached_tile(int z, int x, int y) {
+    return find_tile(tile_key(z, x, y), z, x, y);
+}
+
+int TileResource::memory_tiles() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return tiles_.memory.size();
+}
+
+size_t TileResource::memory_size() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return tiles_.size + viewports_.size;
+}
+
+int TileResource::upstream_requests() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return upstream_requests_;
+}
+
+static bool read_file(const std::string& path, TileResource::Tile& tile) {
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::ostringstream data;
+    data << file.rdbuf();
+    if (!file) {
+        return false;
+    }
+    tile = boost::make_shared<std::string>(data.str());
+    return true;
+}
+
+static void write_file(const std::string& filename,
+                       const TileResource::Tile& tile) {
+    namespace fs = boost::filesystem;
+    std::string tmp;
+    try {
+        fs::create_directories(fs::path(filename).parent_path());
+        // other threads must not see partially written file
+        tmp = filename + "." + rand_string(8);
+        std::ofstream file(tmp.c_str(), std::ios::out | std::ios::binary);
+        file.write(tile->data(), tile->size());
+        file.close();
+        if (file) {
+            fs::rename(tmp, filename);
+            return;
+        }
+    } catch (...)
+    { }
+    // truncated file must not get into the cache
+    if (!tmp.empty()) {
+        boost::system::error_code e;
+        fs::remove(tmp, e);
+    }
+}
+
+static void write_tile(Http::Response& response,
+                       const TileResource::Tile& tile) {
+    if (!tile) {
+        response.setStatus(502);
+        return;
+    }
+    response.setMimeType("image/png");
+    response.addHeader("Cache-Control", "max-age=86400");
+    response.out().write(tile->data(), tile->size());
+}
+
+static void resume(Http::ResponseContinuation* continuation,
+                   const TileResource::Tile& tile) {
+    continuation->setData(tile);
+    continuation->haveMoreData();
+}
+
+void TileResource::handleRequest(const Http::Request& request,
+                                 Http::Response& response) {
+#ifdef WC_HAVE_TILE_VIEWPORT
+    if (request.getParameter("w")) {
+        handle_viewport(request, response);
+        return;
+    }
+#endif
+    Http::ResponseContinuation* continuation = request.continuation();
+    if (continuation) {
+        // upstream request is finished
+        write_tile(response, boost::any_cast<Tile>(continuation->data()));
+        return;
+    }
+    const std::string* z_str = request.getParameter("z");
+    const std::string* x_str = request.getParameter("x");
+    const std::string* y_str = request.getParameter("y");
+    int z, x, y;
+    if (!z_str || !x_str || !y_str ||
+            !parse_integer(*z_str, z) || !parse_integer(*x_str, x) ||
+            !parse_integer(*y_str, y) ||
+            z < 0 || z > max_zoom() ||
+            x < 0 || x >= (1 << z) || y < 0 || y >= (1 << z)) {
+        response.setStatus(404);
+        return;
+    }
+    Tile tile;
+    if (load_tile(z, x, y, tile)) {
+        if (tile) {
+            write_tile(response, tile);
+        } else {
+            response.setStatus(404);
+        }
+        return;
+    }
+    continuation = response.createContinuation();
+    continuation->waitForMoreData();
+    fetch_tile(z, x, y, boost::bind(resume, continuation, _1));
+}
+
+static size_t entry_size(const std::string& key,
+                         const TileResource::Tile& tile) {
+    return key.size() + (tile ? tile->size() : 0) + TILE_OVERHEAD;
+}
+
+TileResource::MemoryCache::MemoryCache(size_t m):
+    size(0), max_size(m)
+{ }
+
+TileResource::Tile TileResource::MemoryCache::find(const std::string& key) {
+    Memory::iterator it = memory.find(key);
+    if (it == memory.end()) {
+        return Tile();
+    }
+    lru.splice(lru.begin(), lru, it->second.lru);
+    return it->second.tile;
+}
+
+void TileResource::MemoryCache::put(const std::string& key,
+                                    const Tile& tile) {
+    Memory::iterator it = memory.find(key);
+    if (it != memory.end()) {
+        size -= entry_size(key, it->second.tile);
+        it->second.tile = tile;
+        lru.splice(lru.begin(), lru, it->second.lru);
+    } else {
+        lru.push_front(key);
+        MemoryTile& memory_tile = memory[key];
+        memory_tile.tile = tile;
+        memory_tile.lru = lru.begin();
+    }
+    size += entry_size(key, tile);
+    shrink();
+}
+
+void TileResource::MemoryCache::shrink() {
+    while (size > max_size && !lru.empty()) {
+        Memory::iterator it = memory.find(lru.back());
+        size -= entry_size(it->first, it->second.tile);
+        memory.erase(it);
+        lru.pop_back();
+    }
+}
+
+TileResource::Tile TileResource::find_in_memory(const std::string& key) {
+    boost::mutex::scoped_lock lock(mutex_);
+    return tiles_.find(key);
+}
+
+void TileResource::remember_viewport(const std::string& key,
+                                     const Tile& image) {
+    boost::mutex::scoped_lock lock(mutex_);
+    viewports_.put(key, image);
+}
+
+TileResource::Tile TileResource::find_tile(const std::string& key,
+        int z, int x, int y) {
+    Tile tile = find_in_memory(key);
+    if (tile) {
+        return tile;
+    }
+    std::string path;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (cache_dir_.empty()) {
+            return Tile();
+        }
+        path = cache_path(z, x, y);
+    }
+    if (read_file(path, tile)) {
+        remember(key, tile);
+    }
+    return tile;
+}
+
+bool TileResource::load_tile(int z, int x, int y, Tile& tile) {
+    std::string key = tile_key(z, x, y);
+    tile = find_tile(key, z, x, y);
+    if (tile) {
+        return true;
+    }
+    std::string upstream = upstream_url(z, x, y);
+    if (upstream.find("://") != std::string::npos) {
+        return false;
+    }
+    // local files
+    if (read_file(upstream, tile)) {
+        remember(key, tile);
+    }
+    return true;
+}
+
+void TileResource::remember(const std::string& key, const Tile& tile) {
+    boost::mutex::scoped_lock lock(mutex_);
+    tiles_.put(key, tile);
+}
+
+std::string TileResource::upstream_url(int z, int x, int y) const {
+    std::string result;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        result = url_template_;
+    }
+    boost::replace_all(result, "{z}", TO_S(z));
+    boost::replace_all(result, "{x}", TO_S(x));
+    boost::replace_all(result, "{y}", TO_S(y));
+    return result;
+}
+
+std::string TileResource::cache_path(int z, int x, int y) const {
+    // mutex_ must be locked
+    return cache_dir_ + "/" + tile_key(z, x, y) + ".png";
+}
+
+void TileResource::fetch_tile(int z, int x, int y,
+                              const TileHandler& handler) {
+    std::string key = tile_key(z, x, y);
+    FetchPtr fetch;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        Fetches::iterator it = fetches_.find(key);
+        if (it != fetches_.end()) {
+            it->second->handlers.push_back(handler);
+            return;
+        }
+        if (failed(key) ||
+                (in_flight_ >= max_in_flight_ &&
+                 int(queue_.size()) >= max_queue_)) {
+            lock.unlock();
+            handler(Tile());
+            return;
+        }
+        fetch = boost::make_shared<Fetch>();
+        fetch->key = key;
+        fetch->z = z;
+        fetch->x = x;
+        fetch->y = y;
+        fetch->handlers.push_back(handler);
+        fetches_[key] = fetch;
+        if (in_flight_ >= max_in_flight_) {
+            queue_.push_back(fetch);
+            return;
+        }
+        in_flight_ += 1;
+    }
+    start_fetch(fetch);
+}
+
+static void delete_client(Http::Client* client) {
+    delete client;
+}
+
+void TileResource::start_fetch(const FetchPtr& fetch) {
+    WServer* server = WServer::instance();
+    if (!server) {
+        finish(fetch, Tile());
+        return;
+    }
+    int timeout;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        timeout = std::max(1, int(timeout_.total_seconds()));
+        upstream_requests_ += 1;
+    }
+    // not bound to any application
+    Http::Client* client = new Http::Client(server->ioService());
+    client->setTimeout(timeout);
+    client->setMaximumResponseSize(MAX_TILE_SIZE);
+    client->done().connect(boost::bind(&TileResource::fetched, this,
+                                       fetch, client, _1, _2));
+    if (!client->get(upstream_url(fetch->z, fetch->x, fetch->y))) {
+        delete client;
+        finish(fetch, Tile());
+    }
+}
+
+void TileResource::fetched(const FetchPtr& fetch, Http::Client* client,
+                           const boost::system::error_code& e,
+                           const Http::Message& message) {
+    // the client can not be deleted from its own signal
+    WServer::instance()->ioService().post(boost::bind(delete_client, client));
+    Tile tile;
+    if (!e && message.status() == 200 && !message.body().empty()) {
+        tile = boost::make_shared<std::string>(message.body());
+        remember(fetch->key, tile);
+        std::string path;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (!cache_dir_.empty()) {
+                path = cache_path(fetch->z, fetch->x, fetch->y);
+            }
+        }
+        if (!path.empty()) {
+            // blocking disk I/O is not done in the thread of the server
+            Executor::instance().post(boost::bind(write_file, path, tile));
+        }
+    }
+    finish(fetch, tile);
+}
+
+void TileResource::finish(const FetchPtr& fetch, const Tile& tile) {
+    std::vector<TileHandler> handlers;
+    FetchPtr next;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        fetches_.erase(fetch->key);
+        handlers.swap(fetch->handlers);
+        if (!tile && failure_ttl_ > td::TD_NULL) {
+            failures_[fetch->key] =
+                boost::posix_time::microsec_clock::universal_time() +
+                failure_ttl_;
+            failures_order_.push_back(fetch->key);
+        }
+        if (!queue_.empty()) {
+            next = queue_.front();
+            queue_.pop_front();
+        } else {
+            in_flight_ -= 1;
+        }
+    }
+    BOOST_FOREACH (const TileHandler& handler, handlers) {
+        handler(tile);
+    }
+    if (next) {
+        start_fetch(next);
+    }
+}
+
+bool TileResource::failed(const std::string& key) {
+    // mutex_ must be locked
+    boost::posix_time::ptime now =
+        boost::posix_time::microsec_clock::universal_time();
+    while (!failures_order_.empty()) {
+        Failures::iterator it = failures_.find(failures_order_.front());
+        if (it != failures_.end()) {
+            if (it->second > now) {
+                break;
+            }
+            failures_.erase(it);
+        }
+        failures_order_.pop_front();
+    }
+    Failures::const_iterator it = failures_.find(key);
+    return it != failures_.end() && it->second > now;
+}
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+static int floor_div(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static bool viewport_tile_xy(const TileResource::Viewport& viewport,
+                             int index, int& x, int& y) {
+    int n = 1 << viewport.z;
+    x = viewport.x0 + index % viewport.columns;
+    x = (x % n + n) % n; // the map is repeated horizontally
+    y = viewport.y0 + index / viewport.columns;
+    return y >= 0 && y < n;
+}
+
+static std::string viewport_key(const TileResource::Viewport& viewport) {
+    return TO_S(viewport.z) + "/" + TO_S(viewport.left) +
+           "/" + TO_S(viewport.top) + "/" + TO_S(viewport.width) +
+           "x" + TO_S(viewport.height);
+}
+
+static TileResource::Tile render_viewport(const TileResource::Viewport& v) {
+    WRasterImage image("png", v.width, v.height);
+    WPainter painter(&image);
+    painter.fillRect(WRectF(0, 0, v.width, v.height), WColor(lightGray));
+    for (int i = 0; i < int(v.tiles.size()); ++i) {
+        const TileResource::Tile& tile = v.tiles[i];
+        if (tile) {
+            std::string uri = "data:image/png;base64," +
+                              Utils::base64Encode(*tile, false);
+            double x = (v.x0 + i % v.columns) * TILE_SIZE - v.left;
+            double y = (v.y0 + i / v.columns) * TILE_SIZE - v.top;
+            painter.drawImage(WPointF(x, y),
+                              WPainter::Image(uri, TILE_SIZE, TILE_SIZE));
+        }
+    }
+    painter.end();
+    std::ostringstream data;
+    image.write(data);
+    return boost::make_shared<std::string>(data.str());
+}
+
+TileResource::ViewportPtr
+TileResource::parse_viewport(const Http::Request& request) {
+    const char* names[] = {"z", "cx", "cy", "w", "h"};
+    int values[5];
+    for (int i = 0; i < 5; ++i) {
+        const std::string* value = request.getParameter(names[i]);
+        if (!value || !parse_integer(*value, values[i])) {
+            return ViewportPtr();
+        }
+    }
+    int z = values[0], cx = values[1], cy = values[2];
+    int width = values[3], height = values[4];
+    // snap_viewport() adds the margin to the size
+    if (z < 0 || z > std::min(MAX_VIEWPORT_ZOOM, max_zoom()) ||
+            width < 1 || width > MAX_VIEWPORT_SIZE + VIEWPORT_GRID ||
+            height < 1 || height > MAX_VIEWPORT_SIZE + VIEWPORT_GRID) {
+        return ViewportPtr();
+    }
+    int map_size = TILE_SIZE << z;
+    if (cy < 0 || cy > map_size) {
+        return ViewportPtr();
+    }
+    // the number of distinct images is bounded;
+    // snapped viewport is not changed
+    cx = (cx % map_size + map_size) % map_size;
+    cx = snap(cx) % map_size;
+    cy = snap(cy);
+    width = round_up(width);
+    height = round_up(height);
+    ViewportPtr viewport = boost::make_shared<Viewport>();
+    viewport->z = z;
+    viewport->left = cx - width / 2;
+    viewport->top = cy - height / 2;
+    viewport->width = width;
+    viewport->height = height;
+    viewport->x0 = floor_div(viewport->left, TILE_SIZE);
+    viewport->y0 = floor_div(viewport->top, TILE_SIZE);
+    viewport->columns = floor_div(viewport->left + width - 1, TILE_SIZE) -
+                        viewport->x0 + 1;
+    viewport->rows = floor_div(viewport->top + height - 1, TILE_SIZE) -
+                     viewport->y0 + 1;
+    viewport->tiles.resize(viewport->columns * viewport->rows);
+    viewport->pending = 0;
+    return viewport;
+}
+
+TileResource::Tile TileResource::viewport_image(const Viewport& viewport) {
+    Tile image = render_viewport(viewport);
+    remember_viewport(viewport_key(viewport), image);
+    return image;
+}
+
+void TileResource::handle_viewport(const Http::Request& request,
+                                   Http::Response& response) {
+    Http::ResponseContinuation* continuation = request.continuation();
+    if (continuation) {
+        // missing tiles are fetched
+        ViewportPtr viewport = boost::any_cast<ViewportPtr>(
+                                   continuation->data());
+        write_tile(response, viewport_image(*viewport));
+        return;
+    }
+    ViewportPtr viewport = parse_viewport(request);
+    if (!viewport) {
+        response.setStatus(404);
+        return;
+    }
+    Tile image;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        image = viewports_.find(viewport_key(*viewport));
+    }
+    if (image) {
+        write_tile(response, image);
+        return;
+    }
+    std::vector<int> missing;
+    for (int i = 0; i < int(viewport->tiles.size()); ++i) {
+        int x, y;
+        if (viewport_tile_xy(*viewport, i, x, y) &&
+                !load_tile(viewport->z, x, y, viewport->tiles[i])) {
+            missing.push_back(i);
+        }
+    }
+    if (missing.empty()) {
+        write_tile(response, viewport_image(*viewport));
+        return;
+    }
+    continuation = response.createContinuation();
+    continuation->setData(viewport);
+    continuation->waitForMoreData();
+    viewport->pending = missing.size();
+    BOOST_FOREACH (int i, missing) {
+        int x, y;
+        viewport_tile_xy(*viewport, i, x, y);
+        fetch_tile(viewport->z, x, y,
+                   boost::bind(&TileResource::viewport_tile, this,
+                               viewport, i, continuation, _1));
+    }
+}
+
+void TileResource::viewport_tile(const ViewportPtr& viewport, int index,
+                                 Http::ResponseContinuation* continuation,
+                                 const Tile& tile) {
+    bool ready;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        viewport->tiles[index] = tile;
+        viewport->pending -= 1;
+        ready = viewport->pending == 0;
+    }
+    if (ready) {
+        continuation->haveMoreData();
+    }
+}
+#endif
+
+}
+
+}
+
@@ -0,0 +1,289 @@
+/*
+ * wt-classes, utility classes used by Wt applications
+ * Copyright (C) 2011 Boris Nagaev
+ *
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef WC_TILE_RESOURCE_HPP_
+#define WC_TILE_RESOURCE_HPP_
+
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/system/error_code.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <Wt/WGlobal>
+#include <Wt/WResource>
+
+#include "config.hpp"
+#include "TimeDuration.hpp"
+
+namespace Wt {
+
+namespace Wc {
+
+/** Caching proxy of map tiles.
+
+Tiles are requested as <tt>url()?z=Z&x=X&y=Y</tt> (see tile_url()).
+A tile is looked up in the memory cache (LRU bounded by size in bytes),
+then in the disk cache
+(if \ref set_cache_dir "set"), then it is taken from the upstream.
+Simultaneous requests of the same tile result in one upstream request.
+Upstream requests are made asynchronously, so threads of the server
+are not blocked while waiting.
+Number of simultaneous upstream requests is limited (max_in_flight()),
+other tiles wait in the queue of size max_queue().
+Tiles which failed to load are not requested again
+during failure_ttl().
+
+The upstream is defined by URL template, where "{z}", "{x}" and "{y}"
+are replaced by coordinates of the tile.
+If the template does not contain "://", it is a path template of
+local files (e.g., a directory of tiles for tests).
+
+The resource must be added to the server:
+\code
+TileResource* tiles = new TileResource;
+tiles->set_cache_dir("/var/cache/myapp/tiles");
+WServer::instance()->addResource(tiles, "/tiles");
+// in session
+map_viewer->set_tile_resource(tiles);
+\endcode
+
+The resource also serves viewport images: tiles covering a rectangle
+of the map are stitched into one PNG image (see viewport_url()).
+Viewport images are kept in separate memory cache
+(see set_max_viewport_memory()).
+This requires WRasterImage.
+
+Methods of this class are thread-safe.
+
+\ingroup bindings
+*/
+class TileResource : public WResource {
+public:
+    /** Constructor.
+    \param url_template Upstream URL template.
+    \param parent Parent object.
+    */
+    TileResource(const std::string& url_template =
+                     "http://a.tile.openstreetmap.org/{z}/{x}/{y}.png",
+                 WObject* parent = 0);
+
+    /** Destructor */
+    ~TileResource();
+
+    /** Return upstream URL template */
+    std::string url_template() const;
+
+    /** Set upstream URL template */
+    void set_url_template(const std::string& url_template);
+
+    /** Return directory of disk cache */
+    std::string cache_dir() const;
+
+    /** Set directory of disk cache (empty means no disk cache).
+    Tiles are stored as cache_dir/z/x/y.png.
+    Fetched tiles are written by Executor::instance().
+    Defaults to empty.
+    */
+    void set_cache_dir(const std::string& cache_dir);
+
+    /** Return max size of tiles in memory (bytes) */
+    size_t max_memory() const;
+
+    /** Set max size of tiles in memory (bytes, defaults to 32 MiB) */
+    void set_max_memory(size_t max_memory);
+
+    /** Return max size of viewport images in memory (bytes) */
+    size_t max_viewport_memory() const;
+
+    /** Set max size of viewport images in memory (bytes).
+    Defaults to 8 MiB.
+    */
+    void set_max_viewport_memory(size_t max_viewport_memory);
+
+    /** Return max zoom level of tiles */
+    int max_zoom() const;
+
+    /** Set max zoom level of tiles (defaults to 19).
+    Tiles of greater zoom levels are not requested from the upstream.
+    Max value is 30.
+    */
+    void set_max_zoom(int max_zoom);
+
+    /** Return max number of simultaneous upstream requests */
+    int max_in_flight() const;
+
+    /** Set max number of simultaneous upstream requests (defaults to 16) */
+    void set_max_in_flight(int max_in_flight);
+
+    /** Return max number of tiles waiting for upstream request */
+    int max_queue() const;
+
+    /** Set max number of tiles waiting for upstream request.
+    If the queue is full, the tile fails at once.
+    Defaults to 256.
+    */
+    void set_max_queue(int max_queue);
+
+    /** Return time during which failed tiles are not requested again */
+    td::TimeDuration failure_ttl() const;
+
+    /** Set time during which failed tiles are not requested again.
+    Defaults to 30 seconds. TD_NULL disables this.
+    */
+    void set_failure_ttl(const td::TimeDuration& failure_ttl);
+
+    /** Return timeout of upstream request */
+    td::TimeDuration timeout() const;
+
+    /** Set timeout of upstream request (defaults to 10 seconds).
+    The precision is 1 second.
+    */
+    void set_timeout(const td::TimeDuration& timeout);
+
+    /** Return URL of the tile, served by this resource */
+    std::string tile_url(int z, int x, int y) const;
+
+    /** Return template of URL of tiles, served by this resource.
+    The template uses "${z}", "${x}" and "${y}" (syntax of OpenLayers).
+    */
+    std::string tile_url_template() const;
+
+#ifdef WC_HAVE_TILE_VIEWPORT
+    /** Return URL of the viewport image, served by this resource.
+    \param z Zoom level.
+    \param center_x Horizontal pixel coordinate of the center
+        on the whole map of this zoom level (the map is 256 * 2^z pixels).
+    \param center_y Vertical pixel coordinate of the center.
+    \param width Width of the image in pixels.
+    \param height Height of the image in pixels.
+
+    Max zoom level of a viewport image is 22 (and max_zoom()),
+    max width and height are 2048.
+
+    The resource changes the viewport with snap_viewport().
+    Pass the snapped viewport to know the image returned.
+    */
+    std::string viewport_url(int z, int center_x, int center_y,
+                             int width, int height) const;
+
+    /** Snap the viewport to the grid of viewport images.
+    The center is rounded to multiple of 64 pixels,
+    width and height are increased, so that the snapped viewport
+    covers the original one.
+    This bounds the number of distinct viewport images.
+    */
+    static void snap_viewport(int& center_x, int& center_y,
+                              int& width, int& height);
+#endif
+
+    /** Return tile (PNG) from memory or disk cache (0 if not found) */
+    boost::shared_ptr<const std::string> cached_tile(int z, int x, int y);
+
+    /** Return number of tiles in memory */
+    int memory_tiles() const;
+
+    /** Return size of tiles and viewport images in memory (bytes) */
+    size_t memory_size() const;
+
+    /** Return number of tiles requested from the upstream */
+    int upstream_requests() const;
+
+    /** Handles a request */
+    void handleRequest(const Http::Request& request, Http::Response& response);
+
+#ifndef DOXYGEN_ONLY
+    typedef boost::shared_ptr<const std::string> Tile;
+    typedef boost::function<void(const Tile&)> TileHandler;
+    struct Fetch;
+    struct Viewport;
+#endif
+
+private:
+    typedef std::list<std::string> Lru;
+
+    struct MemoryTile {
+        Tile tile;
+        Lru::iterator lru;
+    };
+
+    typedef boost::unordered_map<std::string, MemoryTile> Memory;
+
+    /* LRU bounded by size in bytes, mutex_ must be locked */
+    struct MemoryCache {
+        Memory memory;
+        Lru lru;
+        size_t size;
+        size_t max_size;
+
+        MemoryCache(size_t m);
+        Tile find(const std::string& key);
+        void put(const std::string& key, const Tile& tile);
+        void shrink();
+    };
+    typedef boost::shared_ptr<Fetch> FetchPtr;
+    typedef boost::unordered_map<std::string, FetchPtr> Fetches;
+    typedef boost::unordered_map<std::string,
+            boost::posix_time::ptime> Failures;
+    typedef boost::shared_ptr<Viewport> ViewportPtr;
+
+    std::string url_template_;
+    std::string cache_dir_;
+    int max_zoom_;
+    int max_in_flight_;
+    int max_queue_;
+    td::TimeDuration failure_ttl_;
+    td::TimeDuration timeout_;
+    MemoryCache tiles_;
+    MemoryCache viewports_;
+    Fetches fetches_;
+    int in_flight_;
+    std::deque<FetchPtr> queue_;
+    // failed tiles and time of expiration
+    Failures failures_;
+    // keys of failures_ in order of addition
+    std::deque<std::string> failures_order_;
+    int upstream_requests_;
+    mutable boost::mutex mutex_;
+
+    Tile find_in_memory(const std::string& key);
+    void remember_viewport(const std::string& key, const Tile& image);
+    Tile find_tile(const std::string& key, int z, int x, int y);
+    bool load_tile(int z, int x, int y, Tile& tile);
+    void remember(const std::string& key, const Tile& tile);
+    std::string upstream_url(int z, int x, int y) const;
+    std::string cache_path(int z, int x, int y) const;
+    void fetch_tile(int z, int x, int y, const TileHandler& handler);
+    void start_fetch(const FetchPtr& fetch);
+    void fetched(const FetchPtr& fetch, Http::Client* client,
+                 const boost::system::error_code& e,
+                 const Http::Message& message);
+    void finish(const FetchPtr& fetch, const Tile& tile);
+    bool failed(const std::string& key);
+#ifdef WC_HAVE_TILE_VIEWPORT
+    ViewportPtr parse_viewport(const Http::Request& request);
+    Tile viewport_image(const Viewport& viewport);
+    void handle_viewport(const Http::Request& request,
+                         Http::Response& response);
+    void viewport_tile(const ViewportPtr& viewport, int index,
+                       Http::ResponseContinuation* continuation,
+                       const Tile& tile);
+#endif
+};
+
+}
+
+}
+
+#endif
+
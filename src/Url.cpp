@@ -126,16 +126,16 @@ IntegerNode::IntegerNode(WObject* parent):
 { }
 
 bool IntegerNode::meet(const std::string& part) const {
-    try {
-        boost::lexical_cast<long long>(part);
-        return true;
-    } catch (...) {
-        return false;
-    }
+    long long v;
+    return parse_integer(part, v);
 }
 
 long long IntegerNode::integer() const {
-    return boost::lexical_cast<long long>(value());
+    long long v;
+    if (!parse_integer(value(), v)) {
+        throw boost::bad_lexical_cast();
+    }
+    return v;
 }
 
 void IntegerNode::set_integer_value(long long v) {
@@ -193,8 +193,10 @@ Node* Parser::parse(const std::string& path) {
     std::vector<std::string> parts;
     split(parts, path, is_any_of("/"), token_compress_on);
     Node* node = this;
-    BOOST_FOREACH (std::string part, parts) {
-        part = urldecode(part);
+    std::string part;
+    BOOST_FOREACH (const std::string& encoded, parts) {
+        part.clear();
+        urldecode(encoded, part);
         if (part.empty()) {
             continue;
         }
@@ -18,6 +18,7 @@
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
 #include <boost/foreach.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -55,6 +56,7 @@
 #include "TableForm.hpp"
 #include "FileView.hpp"
 #include "util.hpp"
+#include "Executor.hpp"
 
 namespace Wt {
 
@@ -645,7 +647,8 @@ void TableTask::changed_handler() {
 AbstractRunner::AbstractRunner():
     state_(UNSET),
     task_(0),
-    exit_status_(0) {
+    exit_status_(0),
+    executor_(0) {
     bound_finished_handler_ = bound_post(boost::bind(
             &AbstractRunner::finished_handler, this));
 }
@@ -693,6 +696,103 @@ void AbstractRunner::finished_handler() {
     task()->changed_emitter();
 }
 
+struct AbstractRunner::Job {
+    Job():
+        canceled(false), started(false), finished(false)
+    { }
+
+    bool is_canceled() {
+        boost::mutex::scoped_lock lock(mutex);
+        return canceled;
+    }
+
+    void cancel() {
+        boost::mutex::scoped_lock lock(mutex);
+        canceled = true;
+    }
+
+    // returns false if the job was canceled before it started
+    bool start() {
+        boost::mutex::scoped_lock lock(mutex);
+        started = !canceled;
+        return started;
+    }
+
+    void finish() {
+        boost::mutex::scoped_lock lock(mutex);
+        finished = true;
+        cond.notify_all();
+    }
+
+    void wait() {
+        boost::mutex::scoped_lock lock(mutex);
+        while (started && !finished) {
+            cond.wait(lock);
+        }
+    }
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool canceled;
+    bool started;
+    bool finished;
+};
+
+// returns if the job, running in this thread, was canceled
+typedef boost::function<bool()> CanceledChecker;
+typedef boost::thread_specific_ptr<CanceledChecker> CanceledCheckerPtr;
+static CanceledCheckerPtr current_job_checker;
+
+void AbstractRunner::start_job(const boost::function<void()>& func) {
+    job_ = boost::make_shared<Job>();
+    boost::function<void()> job_func = boost::bind(run_job, job_, func);
+    if (executor_) {
+        executor_->post(job_func);
+    } else {
+        thread_ = boost::thread(job_func);
+    }
+}
+
+void AbstractRunner::cancel_job() {
+    if (job_) {
+        job_->cancel();
+    }
+    thread_.interrupt();
+}
+
+void AbstractRunner::wait_job() {
+    if (job_) {
+        // a job, which was not started yet, is never started
+        job_->cancel();
+        job_->wait();
+    }
+}
+
+bool AbstractRunner::job_canceled() {
+    if (current_job_checker.get()) {
+        return (*current_job_checker)();
+    } else {
+        return boost::this_thread::interruption_requested();
+    }
+}
+
+void AbstractRunner::run_job(JobPtr job, const boost::function<void()>& func) {
+    if (!job->start()) {
+        return;
+    }
+    current_job_checker.reset(new CanceledChecker(
+                                  boost::bind(&Job::is_canceled, job)));
+    try {
+        func();
+    } catch (...) {
+        current_job_checker.reset();
+        job->finish();
+        throw;
+    }
+    current_job_checker.reset();
+    job->finish();
+}
+
 ForkingRunner::ForkingRunner(const std::string& command,
                              const std::string& suffix):
     command_(command), suffix_(suffix), pid_file_(FileOutput::unique_name()),
@@ -703,6 +803,8 @@ ForkingRunner::~ForkingRunner() {
     if (state() == WORKING) {
         cancel_impl();
     }
+    // the job uses this object
+    wait_job();
     remove(pid_file_.c_str());
 }
 
@@ -712,12 +814,12 @@ void ForkingRunner::run_impl() {
     }
     if (state() == NEW) {
         set_state(WORKING);
-        thread_ = boost::thread(&ForkingRunner::start_process, this, command());
+        start_job(boost::bind(&ForkingRunner::start_process, this, command()));
     }
 }
 
 void ForkingRunner::cancel_impl() {
-    thread_.interrupt();
+    cancel_job();
     std::stringstream cmd;
     cmd << "pkill -" << signal_ << " -P `cat " << pid_file_ << "`";
     system(cmd.str().c_str());
@@ -752,7 +854,7 @@ std::string ForkingRunner::command() const {
 
 void ForkingRunner::start_process(std::string cmd) {
     set_exit_status(system(cmd.c_str()));
-    if (!boost::this_thread::interruption_requested()) {
+    if (!job_canceled()) {
         finish();
     }
 }
@@ -768,6 +870,8 @@ BoostOptionsRunner::~BoostOptionsRunner() {
     if (state() == WORKING) {
         cancel_impl();
     }
+    // the job uses this object
+    wait_job();
 }
 
 void push_back(std::vector<std::string>& v, const std::string& str, bool) {
@@ -800,12 +904,12 @@ void BoostOptionsRunner::run_impl() {
             return;
         }
         OneAnyFunc e = one_bound_post(boost::bind(set_message, task(), _1));
-        thread_ = boost::thread(&BoostOptionsRunner::call_handler, this, vm, e);
+        start_job(boost::bind(&BoostOptionsRunner::call_handler, this, vm, e));
     }
 }
 
 void BoostOptionsRunner::cancel_impl() {
-    thread_.interrupt();
+    cancel_job();
 }
 
 void BoostOptionsRunner::call_handler(BoostOptionsRunner::MapPtr vm,
@@ -988,6 +988,22 @@ public:
         return exit_status_;
     }
 
+    /** Get executor used to run programs (0 means new thread per run) */
+    Executor* executor() const {
+        return executor_;
+    }
+
+    /** Set executor used to run programs.
+    By default (0), each run starts new boost::thread.
+    If the executor is set, runs are passed to Executor::post() and
+    share threads of the executor (e.g., Executor::instance()).
+
+    \note The ownership of the executor is not transferred.
+    */
+    void set_executor(Executor* executor) {
+        executor_ = executor;
+    }
+
 protected:
     /** Method to be called when the program is finished.
      - change the state() to FINISHED,
@@ -1056,11 +1072,44 @@ protected:
         exit_status_ = exit_status;
     }
 
+    /** Start the function in new thread or in the executor().
+    This method should be called from run_impl().
+    */
+    void start_job(const boost::function<void()>& func);
+
+    /** Cancel the job started by start_job().
+    If the job was not started yet (executor() is busy), it is not started.
+    If the job is running in its own thread, the thread is interrupted.
+    A job running in the executor() is not interrupted,
+    but job_canceled() returns \c true.
+    */
+    void cancel_job();
+
+    /** Wait until the job started by start_job() is finished.
+    If the job was not started yet, it is canceled and never started.
+    The job uses the runner, so the destructor of the runner,
+    which calls start_job(), must call this method (after cancel_job()).
+    */
+    void wait_job();
+
+    /** Return if the job running in this thread was canceled.
+    This method should be called from the job.
+    */
+    static bool job_canceled();
+
 private:
+    struct Job;
+    typedef boost::shared_ptr<Job> JobPtr;
+
     RunState state_;
     AbstractTask* task_;
     boost::function<void()> bound_finished_handler_;
     int exit_status_;
+    Executor* executor_;
+    JobPtr job_;
+    boost::thread thread_;
+
+    static void run_job(JobPtr job, const boost::function<void()>& func);
 
     void set_task(AbstractTask* task);
     void finished_handler();
@@ -1088,6 +1137,7 @@ public:
 
     /** Destructor.
      - If state is WORKING, call cancel_impl()
+     - wait until the job is finished (see wait_job())
      - remove pid file.
     */
     ~ForkingRunner();
@@ -1118,7 +1168,6 @@ private:
     std::string command_;
     std::string suffix_;
     std::string pid_file_;
-    boost::thread thread_;
     int signal_;
 
     std::string command() const;
@@ -1144,20 +1193,23 @@ public:
     \param handler The function, called with variables_map.
     \param desc The description of options.
     If options are correct (successfully stored to \p variables_map),
-    the handler is called in new boost thread with this \p variables_map.
+    the handler is called in new boost thread (or in the executor())
+    with this \p variables_map.
     If the handler throwes std::exception, the task is considered failed.
     */
     BoostOptionsRunner(const Handler& handler, const options_description* desc);
 
     /** Destructor.
      - If state is WORKING, call cancel_impl()
+     - wait until the job is finished (see wait_job()).
+    The handler should check job_canceled() to stop early.
     */
     ~BoostOptionsRunner();
 
 protected:
     void run_impl();
 
-    /** Calls boost::thread::interrupt() */
+    /** Calls cancel_job() */
     void cancel_impl();
 
 private:
@@ -1166,7 +1218,6 @@ private:
 
     Handler handler_;
     const options_description* desc_;
-    boost::thread thread_;
 
     void call_handler(MapPtr vm, OneAnyFunc es);
 };
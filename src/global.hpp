@@ -31,6 +31,7 @@ class EtagStoreResource;
 class Gather;
 class AbstractCaptcha;
 class PaintedCaptcha;
+class CaptchaPool;
 class Recaptcha;
 class FilterResource;
 class Countdown;
@@ -41,9 +42,15 @@ class FileView;
 class ResourceView;
 class MapImage;
 class MapViewer;
+class TileResource;
 class Pager;
 class GlobalLocalizedStrings;
 class CachedContents;
+class HtmlCache;
+class Executor;
+class Md5;
+class ConfigRegistry;
+class RateLimiter;
 
 class AbstractArgument;
 class AbstractInput;
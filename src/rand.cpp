@@ -6,49 +6,221 @@
  */
 
 #include "config.hpp"
-#include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <ctime>
 #include <fstream>
+#include <stdint.h>
+#include "boost-xtime.hpp"
+#include <boost/thread/tss.hpp>
+#include <boost/thread/once.hpp>
 
 #ifdef WC_HAVE_WRANDOM
 #include <Wt/WRandom>
-#else
-#include <cstdlib>
-#include <ctime>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
 #endif
 
 #include "rand.hpp"
-#include "util.hpp"
 
 namespace Wt {
 
 namespace Wc {
 
-#ifndef WC_HAVE_WRANDOM
-struct Srander {
-    Srander() {
-        std::srand(time(NULL));
+static inline uint32_t rotl32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+#define WC_CHACHA_QR(a, b, c, d) \
+    a += b; d ^= a; d = rotl32(d, 16); \
+    c += d; b ^= c; b = rotl32(b, 12); \
+    a += b; d ^= a; d = rotl32(d, 8); \
+    c += d; b ^= c; b = rotl32(b, 7);
+
+/* ChaCha20 keystream generator, one per thread.
+The key is taken from the OS (/dev/urandom) and is replaced
+by the output of the generator itself after each REKEY_BYTES bytes
+(and from the OS after fork).
+*/
+class ChaChaRandom {
+public:
+    ChaChaRandom() {
+        seed();
     }
-} srander;
+
+    void fill(void* data, size_t size) {
+#ifndef _WIN32
+        if (getpid() != pid_) {
+            // forked process must not repeat output of the parent,
+            // including the rest of the buffer
+            memset(buffer_, 0, sizeof(buffer_));
+            seed();
+        }
 #endif
+        unsigned char* out = static_cast<unsigned char*>(data);
+        while (size) {
+            if (pos_ == BUFFER_SIZE) {
+                refill();
+            }
+            size_t n = std::min(size, size_t(BUFFER_SIZE - pos_));
+            memcpy(out, buffer_ + pos_, n);
+            // do not keep returned bytes in memory
+            memset(buffer_ + pos_, 0, n);
+            pos_ += n;
+            out += n;
+            size -= n;
+        }
+    }
+
+    uint32_t get32() {
+        uint32_t result;
+        fill(&result, sizeof(result));
+        return result;
+    }
+
+    uint64_t get64() {
+        uint64_t result;
+        fill(&result, sizeof(result));
+        return result;
+    }
 
-const unsigned int UINT_MIN = 0;
+private:
+    static const int BLOCKS = 4;
+    static const int BUFFER_SIZE = BLOCKS * 64;
+    static const uint64_t REKEY_BYTES = 1024 * 1024;
 
-unsigned int rr() {
+    uint32_t key_[8];
+    uint64_t counter_;
+    uint64_t generated_;
+    unsigned char buffer_[BUFFER_SIZE];
+    int pos_;
+#ifndef _WIN32
+    pid_t pid_;
+#endif
+
+    void seed() {
+        bool ok = false;
+        std::ifstream urandom("/dev/urandom", std::ios::binary);
+        if (urandom.good()) {
+            urandom.read(reinterpret_cast<char*>(key_), sizeof(key_));
+            ok = (urandom.gcount() == sizeof(key_));
+        }
+        if (!ok) {
 #ifdef WC_HAVE_WRANDOM
-    return WRandom::get();
+            for (int i = 0; i < 8; ++i) {
+                key_[i] = WRandom::get();
+            }
 #else
-    // TODO use boost random if available
-    return rand();
+            // weak fallback
+            key_[0] = uint32_t(std::time(0));
+            key_[1] = uint32_t(std::clock());
+            key_[2] = uint32_t(reinterpret_cast<size_t>(this));
+            key_[3] = uint32_t(reinterpret_cast<size_t>(&ok));
+            for (int i = 4; i < 8; ++i) {
+                key_[i] = uint32_t(std::rand());
+            }
 #endif
+        }
+        counter_ = 0;
+        generated_ = 0;
+        pos_ = BUFFER_SIZE;
+#ifndef _WIN32
+        pid_ = getpid();
+#endif
+    }
+
+    void refill() {
+        if (generated_ >= REKEY_BYTES) {
+            // fast key erasure: past output can not be recovered
+            unsigned char new_key[64];
+            block(new_key);
+            set_key(new_key);
+            memset(new_key, 0, sizeof(new_key));
+        }
+        for (int i = 0; i < BLOCKS; ++i) {
+            block(buffer_ + 64 * i);
+        }
+        generated_ += BUFFER_SIZE;
+        pos_ = 0;
+    }
+
+    void set_key(const unsigned char* new_key) {
+        memcpy(key_, new_key, sizeof(key_));
+        counter_ = 0;
+        generated_ = 0;
+    }
+
+    void block(unsigned char* out) {
+        uint32_t input[16] = {
+            0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+            key_[0], key_[1], key_[2], key_[3],
+            key_[4], key_[5], key_[6], key_[7],
+            uint32_t(counter_), uint32_t(counter_ >> 32), 0, 0
+        };
+        counter_ += 1;
+        uint32_t x[16];
+        memcpy(x, input, sizeof(x));
+        for (int i = 0; i < 10; ++i) {
+            WC_CHACHA_QR(x[0], x[4], x[8], x[12]);
+            WC_CHACHA_QR(x[1], x[5], x[9], x[13]);
+            WC_CHACHA_QR(x[2], x[6], x[10], x[14]);
+            WC_CHACHA_QR(x[3], x[7], x[11], x[15]);
+            WC_CHACHA_QR(x[0], x[5], x[10], x[15]);
+            WC_CHACHA_QR(x[1], x[6], x[11], x[12]);
+            WC_CHACHA_QR(x[2], x[7], x[8], x[13]);
+            WC_CHACHA_QR(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; ++i) {
+            uint32_t v = x[i] + input[i];
+            out[4 * i] = (unsigned char)(v);
+            out[4 * i + 1] = (unsigned char)(v >> 8);
+            out[4 * i + 2] = (unsigned char)(v >> 16);
+            out[4 * i + 3] = (unsigned char)(v >> 24);
+        }
+    }
+};
+
+#undef WC_CHACHA_QR
+
+typedef boost::thread_specific_ptr<ChaChaRandom> ChaChaRandomPtr;
+static ChaChaRandomPtr chacha_random_ptr;
+
+static ChaChaRandom& chacha_random() {
+    if (chacha_random_ptr.get() == 0) {
+        chacha_random_ptr.reset(new ChaChaRandom());
+    }
+    return *chacha_random_ptr;
+}
+
+void rand_fill(void* data, size_t size) {
+    chacha_random().fill(data, size);
+}
+
+unsigned int rr() {
+    return chacha_random().get32();
 }
 
 unsigned int rr(unsigned int stop) {
-#ifdef WC_HAVE_WRANDOM
-    return WRandom::get() % stop;
-#else
-    return rand() / (RAND_MAX / stop + 1);
-#endif
+    if (stop == 0) {
+        return 0;
+    }
+    // Lemire's method: multiply and reject the biased part
+    ChaChaRandom& random = chacha_random();
+    uint64_t m = uint64_t(random.get32()) * stop;
+    uint32_t low = uint32_t(m);
+    if (low < stop) {
+        uint32_t threshold = uint32_t(-stop) % stop;
+        while (low < threshold) {
+            m = uint64_t(random.get32()) * stop;
+            low = uint32_t(m);
+        }
+    }
+    return unsigned(m >> 32);
 }
 
 unsigned int rr(unsigned int start, unsigned int stop) {
@@ -60,9 +232,10 @@ unsigned int rr(unsigned int start, unsigned int stop, unsigned int step) {
 }
 
 double drr(double start, double stop) {
-    double stop_start = stop - start;
-    const double max_min = UINT_MAX - UINT_MIN;
-    return start + double(rr()) / max_min * stop_start;
+    // 53 random bits, uniform in [0, 1)
+    const double TWO_POW_53 = 9007199254740992.0;
+    double r = double(chacha_random().get64() >> 11) / TWO_POW_53;
+    return start + r * (stop - start);
 }
 
 ptrdiff_t rand_for_shuffle(ptrdiff_t i) {
@@ -70,41 +243,156 @@ ptrdiff_t rand_for_shuffle(ptrdiff_t i) {
 }
 
 std::string rand_string(int length) {
-#ifdef WC_HAVE_WRANDOM
-    return WRandom::generateId(length);
-#else
-    const std::string abc = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                            "abcdefghijklmnopqrstuvwxyz"
-                            "0123456789";
+    static const char ABC[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                              "abcdefghijklmnopqrstuvwxyz"
+                              "0123456789";
+    const unsigned ABC_SIZE = sizeof(ABC) - 1; // 62
     std::string result;
+    if (length <= 0) {
+        return result;
+    }
     result.reserve(length);
-    for (int i = 0; i < length; i++) {
-        result += abc[rr(abc.length())];
+    ChaChaRandom& random = chacha_random();
+    unsigned char bytes[64];
+    while (int(result.size()) < length) {
+        // 6 bits per char; values >= 62 are rejected (unbiased)
+        size_t n = std::min(sizeof(bytes), size_t(length - result.size()) +
+                            size_t(length - result.size()) / 16 + 1);
+        random.fill(bytes, n);
+        for (size_t i = 0; i < n && int(result.size()) < length; ++i) {
+            unsigned v = bytes[i] & 63;
+            if (v < ABC_SIZE) {
+                result += ABC[v];
+            }
+        }
     }
     return result;
-#endif
 }
 
-std::string good_password() {
+// common short English words
+static const char* const DEFAULT_WORDS[] = {
+    "able", "acid", "aged", "also", "area", "army", "away", "baby", "back",
+    "ball", "band", "bank", "base", "bath", "bear", "beat", "bell", "belt",
+    "bird", "blue", "boat", "body", "bone", "book", "boot", "born", "boss",
+    "bowl", "bulk", "burn", "bush", "busy", "cake", "call", "calm", "camp",
+    "card", "care", "cart", "case", "cash", "cast", "cell", "chef", "chip",
+    "city", "clay", "club", "coal", "coat", "code", "cold", "cook", "cool",
+    "cope", "copy", "cord", "core", "corn", "cost", "crew", "crop", "dark",
+    "data", "date", "dawn", "deal", "dear", "deck", "deep", "deer", "desk",
+    "dial", "diet", "dirt", "dish", "dock", "door", "dose", "down", "draw",
+    "drum", "duck", "dust", "duty", "each", "earn", "east", "easy", "edge",
+    "else", "epic", "even", "ever", "exit", "face", "fact", "fair", "fall",
+    "farm", "fast", "fate", "fear", "feed", "feel", "file", "film", "find",
+    "fine", "fire", "firm", "fish", "flag", "flat", "flow", "folk", "food",
+    "foot", "form", "fort", "free", "frog", "fuel", "full", "fund", "gain",
+    "game", "gate", "gear", "gift", "girl", "give", "glad", "glow", "goal",
+    "gold", "golf", "good", "grab", "gray", "grid", "grow", "gulf", "hair",
+    "half", "hall", "hand", "hard", "harm", "hawk", "head", "heat", "help",
+    "herb", "hero", "high", "hill", "hint", "hold", "hole", "home", "hook",
+    "hope", "horn", "host", "hour", "huge", "hunt", "idea", "inch", "iron",
+    "item", "jazz", "join", "joke", "jump", "jury", "keen", "keep", "kick",
+    "kind", "king", "kite", "knee", "knot", "lake", "lamp", "land", "lane",
+    "last", "late", "lawn", "lead", "leaf", "lean", "left", "lens", "life",
+    "lift", "line", "link", "lion", "list", "live", "load", "loan", "lock",
+    "loft", "long", "look", "loop", "lord", "love", "luck", "lung", "main",
+    "make", "mall", "many", "mark", "mask", "mass", "meal", "meat", "meet",
+    "melt", "menu", "mild", "milk", "mind", "mine", "mint", "miss", "mode",
+    "moon", "more", "moss", "most", "move", "much", "nail", "name", "navy",
+    "near", "neck", "need", "nest", "news", "next", "nice", "nine", "node",
+    "none", "noon", "nose", "note", "oath", "okay", "once", "only", "open",
+    "oval", "oven", "over", "pace", "pack", "page", "pair", "palm", "park",
+    "part", "pass", "past", "path", "peak", "pear", "pick", "pine", "pink",
+    "pipe", "plan", "play", "plot", "plum", "poem", "poet", "pole", "pond",
+    "pool", "port", "post", "pull", "pump", "pure", "push", "quiz", "race",
+    "rail", "rain", "rank", "rare", "rate", "read", "real", "reef", "rest",
+    "rice", "rich", "ride", "ring", "rise", "road", "rock", "roof", "room",
+    "root", "rope", "rose", "ruby", "rule", "safe", "sail", "salt", "sand",
+    "save", "seal", "seat", "seed", "self", "ship", "shoe", "shop", "show",
+    "side", "sign", "silk", "sing", "site", "size", "skin", "slow", "snow",
+    "soap", "sock", "soft", "soil", "song", "soon", "sort", "soup", "spot",
+    "star", "stay", "step", "stop", "suit", "sure", "swim", "tail", "take",
+    "tale", "talk", "tall", "tank", "tape", "task", "team", "tent", "term",
+    "test", "text", "tide", "tile", "time", "tiny", "tone", "tool", "tour",
+    "town", "tree", "trip", "true", "tube", "tune", "turn", "twin", "type",
+    "unit", "upon", "used", "vast", "verb", "very", "vest", "view", "vote",
+    "wage", "wait", "wake", "walk", "wall", "warm", "wash", "wave", "wealth",
+    "wide", "wild", "wind", "wine", "wing", "wire", "wise", "wolf", "wood",
+    "wool", "word", "work", "yard", "year", "zero", "zone",
+};
+
+static const char SEPARATORS[] = "0123456789-_.+=!";
+
+static Wordlist* default_wordlist_ = 0;
+static boost::once_flag default_wordlist_once = BOOST_ONCE_INIT;
+
+static void create_default_wordlist() {
+    static Wordlist words(DEFAULT_WORDS, DEFAULT_WORDS +
+                          sizeof(DEFAULT_WORDS) / sizeof(DEFAULT_WORDS[0]));
+    default_wordlist_ = &words;
+}
+
+const Wordlist& default_wordlist() {
+    boost::call_once(default_wordlist_once, create_default_wordlist);
+    return *default_wordlist_;
+}
+
+bool load_wordlist(const std::string& filename, Wordlist& words) {
+    std::ifstream file(filename.c_str());
+    if (!file.good()) {
+        return false;
+    }
+    Wordlist result;
+    std::string word;
+    while (file >> word) {
+        result.push_back(word);
+    }
+    // duplicates would decrease entropy
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    if (result.size() < 2) {
+        return false;
+    }
+    words.swap(result);
+    return true;
+}
+
+double passphrase_word_bits(const Wordlist& words) {
+    const double LN_2 = 0.69314718055994530942;
+    return std::log(double(words.size())) / LN_2;
+}
+
+std::string rand_passphrase(double bits, const Wordlist& words) {
     std::string result;
-    std::string filename = unique_filename();
-    std::string cmd = "pwqgen > " + filename;
-    system(cmd.c_str());
-    std::ifstream stream(filename.c_str());
-    if (stream.good()) {
-        stream >> result;
-    }
-    stream.close();
-    remove(filename.c_str());
-    if (result.size() < 4) {
-        result = rand_string(16);
-        result[rr(0, 15)] = '$';
-        result[rr(0, 15)] = '%';
-        result[rr(0, 15)] = '_';
+    if (words.size() < 2) {
+        return result;
+    }
+    const int SEPARATOR_BITS = 4; // 16 separators
+    const int CASE_BITS = 1;
+    double word_bits = passphrase_word_bits(words);
+    double total = 0;
+    while (result.empty() || total < bits) {
+        const std::string& word = words[rr(words.size())];
+        size_t start = result.size();
+        if (result.empty()) {
+            // first word is always capitalized to have upper case letter
+            total += word_bits;
+        } else {
+            result += SEPARATORS[rr(sizeof(SEPARATORS) - 1)];
+            start += 1;
+            total += word_bits + SEPARATOR_BITS + CASE_BITS;
+        }
+        result += word;
+        if (start == 0 || rr(2)) {
+            result[start] = std::toupper(result[start]);
+        }
     }
     return result;
 }
 
+std::string good_password() {
+    return rand_passphrase();
+}
+
 }
 
 }
@@ -10,6 +10,7 @@
 
 #include <cstddef>
 #include <string>
+#include <vector>
 
 namespace Wt {
 
@@ -18,9 +19,21 @@ namespace Wc {
 /** \defgroup rand Random numbers
 Functions to generate random variables.
 
+Random numbers are produced by ChaCha20 keystream generator,
+one per thread, keyed from the OS (/dev/urandom).
+Output is generated in blocks, so a call usually takes
+a few bytes from the buffer of the thread.
+Bounded values (rr(unsigned int) and others) are not biased.
+
 \see rand_range()
 */
 
+/** Fill the buffer with random bytes.
+
+\ingroup rand
+*/
+void rand_fill(void* data, size_t size);
+
 /** Return random number.
 
 \ingroup rand
@@ -66,8 +79,52 @@ ptrdiff_t rand_for_shuffle(ptrdiff_t i);
 */
 std::string rand_string(int length = 16);
 
+/** List of words for rand_passphrase().
+
+\ingroup rand
+*/
+typedef std::vector<std::string> Wordlist;
+
+/** Return built-in list of words (421 common short English words).
+
+\ingroup rand
+*/
+const Wordlist& default_wordlist();
+
+/** Read list of words from the file (whitespace separated).
+Duplicates are removed.
+On failure (the file can not be read or it has less than 2 words),
+\p words is not changed and false is returned.
+
+\ingroup rand
+*/
+bool load_wordlist(const std::string& filename, Wordlist& words);
+
+/** Return entropy of one word from the list (bits).
+
+\ingroup rand
+*/
+double passphrase_word_bits(const Wordlist& words);
+
+/** Return random passphrase with at least the given entropy.
+Passphrase is built from words, separated by random chars
+from "0123456789-_.+=!" (4 bits per separator).
+First word is capitalized, other words are capitalized randomly (1 bit).
+Words are added until the entropy reaches \p bits.
+
+Example (default wordlist, 47 bits): "Gift7Knee.sand=Pool".
+
+If \p words has less than 2 words, empty string is returned.
+
+\ingroup rand
+*/
+std::string rand_passphrase(double bits = 47,
+                            const Wordlist& words = default_wordlist());
+
 /** Return password, which is accepted by default PasswordStrengthValidator.
-Uses \c pwqgen tool. If not awailable, rand_string() is used.
+This is rand_passphrase() with default arguments
+(it used to call \c pwqgen tool, whose passphrases have 47 bits
+of entropy by default).
 
 \ingroup rand
 */
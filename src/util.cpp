@@ -12,6 +12,8 @@
 #define USE_SERVER_POST (defined(WC_HAVE_SERVER_POST) && \
     defined(WC_HAVE_ENVIRONMENT_SERVER))
 
+#define USE_SSE2 defined(__SSE2__)
+
 #include <boost/version.hpp>
 #if BOOST_VERSION >= 104400
 #define BOOST_FILESYSTEM_VERSION 3
@@ -19,23 +21,27 @@
 
 #include <sstream>
 #include <climits>
+#include <algorithm>
+#include <limits>
+#include <deque>
+#include <map>
 #include <cstdio>
 #include <fstream>
 #include <boost/filesystem.hpp>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
 #if !USE_SERVER_POST
 #include <boost/thread.hpp>
-#include <boost/thread/mutex.hpp>
 #endif
-#if !USE_WIOSERVICE
-#include <boost/system/error_code.hpp>
-#include <boost/thread.hpp>
-#include <boost/asio.hpp>
+
+#if USE_SSE2
+#include <emmintrin.h>
 #endif
 
 #ifdef WC_USE_WT_MD5
@@ -67,6 +73,8 @@
 #include "util.hpp"
 #include "rand.hpp"
 #include "TimeDuration.hpp"
+#include "Executor.hpp"
+#include "ConfigRegistry.hpp"
 
 namespace Wt {
 
@@ -84,38 +92,120 @@ static void post(WServer* server, const std::string& app,
     server->post(app, boost::bind(func_runner, func));
 }
 #else
-typedef boost::shared_ptr<bool> BoolPtr;
+/* Fallback implementation of bound_post().
+Each application gets one AppStrand: a queue of posted functions,
+drained by one io thread at a time under application's update lock.
+Functions posted to different applications are executed concurrently.
+The strand is shared by all functions returned by bound_post() for the app;
+AG (a child of the application) marks it dead when the app is deleted.
+*/
+class AppStrand;
+typedef boost::shared_ptr<AppStrand> AppStrandPtr;
+typedef boost::weak_ptr<AppStrand> AppStrandWeakPtr;
+typedef std::deque<boost::function<void()> > Funcs;
 
-class AG : public WObject {
+class AppStrand {
 public:
-    AG(const BoolPtr& ptr):
-        ptr_(ptr)
+    AppStrand(WApplication* app):
+        app_(app), running_(false), dead_(false)
     { }
 
-    ~AG() {
-        *ptr_ = true;
+    static void post(const AppStrandPtr& strand,
+                     const boost::function<void()>& func) {
+        boost::mutex::scoped_lock lock(strand->mutex_);
+        if (strand->dead_) {
+            return;
+        }
+        strand->funcs_.push_back(func);
+        if (!strand->running_) {
+            strand->running_ = true;
+            lock.unlock();
+            schedule_action(td::TD_NULL, boost::bind(&AppStrand::drain,
+                            strand));
+        }
+    }
+
+    static void drain(AppStrandPtr strand) {
+        Funcs funcs;
+        while (strand->take(funcs)) {
+            WApplication* app = strand->app_;
+            if (strand->alive() && !app->isQuited()) {
+                WApplication::UpdateLock app_lock = app->getUpdateLock();
+                while (!funcs.empty() && strand->alive() && !app->isQuited()) {
+                    boost::function<void()> func;
+                    func.swap(funcs.front());
+                    funcs.pop_front();
+                    func();
+                }
+            }
+            funcs.clear();
+        }
+    }
+
+    void kill() {
+        boost::mutex::scoped_lock lock(mutex_);
+        dead_ = true;
+        funcs_.clear();
     }
 
 private:
-    BoolPtr ptr_;
+    WApplication* app_;
+    boost::mutex mutex_;
+    Funcs funcs_;
+    bool running_;
+    bool dead_;
+
+    bool alive() {
+        boost::mutex::scoped_lock lock(mutex_);
+        return !dead_;
+    }
+
+    // moves queued functions to funcs, resets running_ if nothing to do
+    bool take(Funcs& funcs) {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (dead_ || funcs_.empty()) {
+            running_ = false;
+            return false;
+        }
+        funcs.swap(funcs_);
+        return true;
+    }
 };
 
-boost::mutex do_func_mutex;
+typedef std::map<WApplication*, AppStrandWeakPtr> App2Strand;
+boost::mutex app_to_strand_mutex;
+App2Strand app_to_strand;
 
-static void do_func(boost::function<void()> func, WApplication* app,
-                    BoolPtr b) {
-    boost::mutex::scoped_lock do_func_lock(do_func_mutex);
-    if (!*b && !app->isQuited()) {
-        WApplication::UpdateLock app_lock = app->getUpdateLock();
-        if (!*b && !app->isQuited()) {
-            func();
+class AG : public WObject {
+public:
+    AG(WApplication* app, const AppStrandPtr& strand):
+        app_(app), strand_(strand) {
+        app->addChild(this);
+    }
+
+    ~AG() {
+        {
+            boost::mutex::scoped_lock lock(app_to_strand_mutex);
+            app_to_strand.erase(app_);
         }
+        strand_->kill();
     }
-}
 
-static void thread_func(boost::function<void()> func, WApplication* app,
-                        BoolPtr b) {
-    schedule_action(td::TD_NULL, boost::bind(do_func, func, app, b));
+private:
+    WApplication* app_;
+    AppStrandPtr strand_;
+};
+
+static AppStrandPtr app_strand(WApplication* app) {
+    boost::mutex::scoped_lock lock(app_to_strand_mutex);
+    AppStrandWeakPtr& weak_strand = app_to_strand[app];
+    AppStrandPtr strand = weak_strand.lock();
+    if (!strand) {
+        strand = boost::make_shared<AppStrand>(app);
+        weak_strand = strand;
+        new AG(app, strand);
+    }
+    return strand;
 }
 #endif
 
@@ -125,83 +215,145 @@ boost::function<void()> bound_post(boost::function<void()> func) {
         WServer* server = DOWNCAST<WServer*>(wApp->environment().server());
         return boost::bind(post, server, wApp->sessionId(), func);
 #else
-        BoolPtr ptr = boost::make_shared<bool>();
-        *ptr = false;
-        wApp->addChild(new AG(ptr));
-        return boost::bind(thread_func, func, wApp, ptr);
+        return boost::bind(&AppStrand::post, app_strand(wApp), func);
 #endif
     } else {
         return boost::bind(schedule_action, td::TD_NULL, func);
     }
 }
 
-typedef std::vector<boost::any> Anys;
+OneAnyFunc one_bound_post(const OneAnyFunc& func, bool allow_merge) {
+    return one_bound_post<boost::any>(func, allow_merge);
+}
 
-struct OneData {
-    Anys anys;
-    boost::mutex mutex;
-    bool allow_merge;
-};
+void updates_trigger_now() {
+    if (wApp && wApp->updatesEnabled() && !wApp->isQuited()) {
+        wApp->triggerUpdate();
+    }
+}
 
-struct OneAnyFuncBinder {
-    void operator()() {
-        boost::mutex& mutex = arg_ptr->mutex;
-        Anys& anys = arg_ptr->anys;
-        bool allow_merge = arg_ptr->allow_merge;
-        if (allow_merge) {
-            mutex.lock();
-            Anys anys_copy = anys;
-            anys.clear();
-            mutex.unlock();
-            BOOST_FOREACH (const boost::any& arg, anys_copy) {
-                func(arg);
-            }
-        } else {
-            mutex.lock();
-            boost::any arg = anys.back();
-            anys.pop_back();
-            mutex.unlock();
-            func(arg);
+typedef boost::posix_time::ptime PTime;
+
+static PTime clock_now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+
+boost::mutex updates_coalescing_mutex;
+td::TimeDuration updates_window = boost::posix_time::milliseconds(30);
+td::TimeDuration updates_max_latency = boost::posix_time::milliseconds(100);
+
+/* Coalescer of updates_trigger() calls of one application.
+It is a child of the application; it is accessed under application's lock.
+*/
+class UpdatesCoalescer : public WObject {
+public:
+    UpdatesCoalescer(WApplication* app):
+        app_(app), scheduled_(false) {
+        app->addChild(this);
+        flush_poster_ = bound_post(&UpdatesCoalescer::flush_app);
+    }
+
+    ~UpdatesCoalescer();
+
+    static UpdatesCoalescer* get(WApplication* app, bool create);
+
+    void trigger(const td::TimeDuration& window,
+                 const td::TimeDuration& max_latency) {
+        last_ = clock_now();
+        window_ = window;
+        max_latency_ = max_latency;
+        if (!scheduled_) {
+            scheduled_ = true;
+            first_ = last_;
+            schedule(window_);
         }
     }
-    OneAnyFunc func;
-    boost::shared_ptr<OneData> arg_ptr;
-};
 
-struct OneAnyFuncHolder {
-    void operator()(const boost::any& arg) {
-        boost::mutex& mutex = arg_ptr->mutex;
-        Anys& anys = arg_ptr->anys;
-        bool allow_merge = arg_ptr->allow_merge;
-        mutex.lock();
-        bool post_needed = !allow_merge || anys.empty();
-        anys.push_back(arg);
-        mutex.unlock();
-        if (post_needed) {
-            posted_binder();
+private:
+    WApplication* app_;
+    boost::function<void()> flush_poster_;
+    bool scheduled_;
+    PTime first_;
+    PTime last_;
+    td::TimeDuration window_;
+    td::TimeDuration max_latency_;
+
+    void schedule(const td::TimeDuration& wait) {
+        schedule_action(wait, flush_poster_);
+    }
+
+    static void flush_app() {
+        UpdatesCoalescer* coalescer = get(wApp, /* create */ false);
+        if (coalescer) {
+            coalescer->flush();
+        }
+    }
+
+    void flush() {
+        PTime t = clock_now();
+        td::TimeDuration since_last = t - last_;
+        td::TimeDuration since_first = t - first_;
+        if (since_last < window_ && since_first < max_latency_) {
+            // new calls came during the window: wait more, but not too long
+            schedule(std::min(window_ - since_last,
+                              max_latency_ - since_first));
+        } else {
+            scheduled_ = false;
+            updates_trigger_now();
         }
     }
-    boost::function<void()> posted_binder;
-    boost::shared_ptr<OneData> arg_ptr;
 };
 
-OneAnyFunc one_bound_post(const OneAnyFunc& func, bool allow_merge) {
-    OneAnyFuncBinder binder;
-    OneAnyFuncHolder holder;
-    binder.func = func;
-    binder.arg_ptr = boost::make_shared<OneData>();
-    binder.arg_ptr->allow_merge = allow_merge;
-    holder.arg_ptr = binder.arg_ptr;
-    holder.posted_binder = bound_post(binder);
-    return holder;
+typedef std::map<WApplication*, UpdatesCoalescer*> App2Coalescer;
+boost::mutex app_to_coalescer_mutex;
+App2Coalescer app_to_coalescer;
+
+UpdatesCoalescer::~UpdatesCoalescer() {
+    boost::mutex::scoped_lock lock(app_to_coalescer_mutex);
+    app_to_coalescer.erase(app_);
+}
+
+UpdatesCoalescer* UpdatesCoalescer::get(WApplication* app, bool create) {
+    {
+        boost::mutex::scoped_lock lock(app_to_coalescer_mutex);
+        App2Coalescer::iterator it = app_to_coalescer.find(app);
+        if (it != app_to_coalescer.end()) {
+            return it->second;
+        }
+    }
+    if (!create) {
+        return 0;
+    }
+    UpdatesCoalescer* coalescer = new UpdatesCoalescer(app);
+    boost::mutex::scoped_lock lock(app_to_coalescer_mutex);
+    app_to_coalescer[app] = coalescer;
+    return coalescer;
 }
 
 void updates_trigger() {
     if (wApp && wApp->updatesEnabled() && !wApp->isQuited()) {
-        wApp->triggerUpdate();
+        td::TimeDuration window, max_latency;
+        {
+            boost::mutex::scoped_lock lock(updates_coalescing_mutex);
+            window = updates_window;
+            max_latency = updates_max_latency;
+        }
+        if (window <= td::TD_NULL) {
+            wApp->triggerUpdate();
+        } else {
+            UpdatesCoalescer::get(wApp, /* create */ true)->trigger(window,
+                    max_latency);
+        }
     }
 }
 
+void set_updates_coalescing(const td::TimeDuration& window,
+                            const td::TimeDuration& max_latency) {
+    boost::mutex::scoped_lock lock(updates_coalescing_mutex);
+    updates_window = window;
+    updates_max_latency = max_latency;
+}
+
 void updates_poster(WServer* server, WApplication* app) {
 #if USE_SERVER_POST
     server->post(app->sessionId(), updates_trigger);
@@ -247,6 +399,10 @@ std::string unique_filename() {
 }
 
 std::string config_value(const std::string& name, const std::string& def) {
+    const ConfigRegistry& registry = ConfigRegistry::instance();
+    if (registry.loaded()) {
+        return registry.get(name, def);
+    }
     std::string value = def;
     if (wApp) {
         wApp->readConfigurationProperty(name, value);
@@ -267,63 +423,204 @@ std::string md5(const std::string& data) {
     d = reinterpret_cast<const unsigned char*>(data.c_str());
     unsigned long n = data.size();
     unsigned char* digest = MD5(d, n, NULL);
-    std::stringstream result;
-    result << std::hex;
-    result.width(2);
-    result.fill('0');
-    for (int i = 0; i < MD5_DIGEST_LENGTH; ++i) {
-        result.width(2);
-        result << static_cast<unsigned int>(digest[i]);
-    }
-    return result.str();
+    return hex_encode(digest, MD5_DIGEST_LENGTH);
 #endif
 }
 #endif
 
-std::string urlencode(const std::string& url) {
-    std::stringstream result;
-    result.setf(std::ios::hex, std::ios::basefield);
-    result.setf(std::ios::uppercase);
-    result.width(2);
-    result.fill('0');
-    BOOST_FOREACH (char c, url) {
-        if (c == ' ') {
-            result.put('+');
-        } else if (c == '-' || c == '_' || c == '.') {
-            result.put(c);
-        } else if (isalnum(c) && (0 < c && c < 127)) {
-            result.put(c);
-        } else {
-            result.put('%');
-            result << short(c);
+void hex_encode(const void* data, size_t size, char* out) {
+    const unsigned char* input = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        int high = input[i] >> 4;
+        int low = input[i] & 0xF;
+        // ((9 - x) >> 8) is -1 for x > 9 and 0 otherwise
+        out[2 * i] = char('0' + high + (((9 - high) >> 8) & ('a' - '0' - 10)));
+        out[2 * i + 1] = char('0' + low + (((9 - low) >> 8) & ('a' - '0' - 10)));
+    }
+}
+
+std::string hex_encode(const void* data, size_t size) {
+    std::string result(2 * size, '\0');
+    if (size) {
+        hex_encode(data, size, &result[0]);
+    }
+    return result;
+}
+
+std::string hex_encode(const std::string& data) {
+    return hex_encode(data.data(), data.size());
+}
+
+// 1 for chars [a-zA-Z0-9._-], not encoded by urlencode()
+static const unsigned char URL_SAFE[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// value of hex digit or -1
+static const signed char HEX_VALUE[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static const char HEX_UPPER[] = "0123456789ABCDEF";
+
+#if USE_SSE2
+// return length of prefix of full 16-bytes blocks of safe chars
+static size_t url_safe_blocks(const char* data, size_t size) {
+    const __m128i a = _mm_set1_epi8('a' - 1);
+    const __m128i z = _mm_set1_epi8('z' + 1);
+    const __m128i A = _mm_set1_epi8('A' - 1);
+    const __m128i Z = _mm_set1_epi8('Z' + 1);
+    const __m128i d0 = _mm_set1_epi8('0' - 1);
+    const __m128i d9 = _mm_set1_epi8('9' + 1);
+    const __m128i dash = _mm_set1_epi8('-');
+    const __m128i underscore = _mm_set1_epi8('_');
+    const __m128i dot = _mm_set1_epi8('.');
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        // bytes >= 128 are negative, so they are not in ranges
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, a),
+                                      _mm_cmplt_epi8(v, z));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, A),
+                                      _mm_cmplt_epi8(v, Z));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, d0),
+                                      _mm_cmplt_epi8(v, d9));
+        __m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, dash),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, underscore),
+                                                  _mm_cmpeq_epi8(v, dot)));
+        __m128i ok = _mm_or_si128(_mm_or_si128(lower, upper),
+                                  _mm_or_si128(digit, other));
+        if (_mm_movemask_epi8(ok) != 0xFFFF) {
+            break;
         }
     }
-    return result.str();
+    return i;
 }
 
-std::string urldecode(const std::string& text) {
-    // source: src/Wt/Utils.C
-    std::stringstream result;
-    for (unsigned i = 0; i < text.length(); ++i) {
-        char c = text[i];
-        if (c == '+') {
-            result << ' ';
-        } else if (c == '%' && i + 2 < text.length()) {
-            std::string h = text.substr(i + 1, 2);
-            char* e = 0;
-            int hval = std::strtol(h.c_str(), &e, 16);
-            if (*e == 0) {
-                result << (char)hval;
-                i += 2;
+// return length of prefix of full 16-bytes blocks without '%' and '+'
+static size_t url_plain_blocks(const char* data, size_t size) {
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, percent),
+                                       _mm_cmpeq_epi8(v, plus));
+        if (_mm_movemask_epi8(special) != 0) {
+            break;
+        }
+    }
+    return i;
+}
+#endif
+
+void urlencode(const std::string& url, std::string& out) {
+    const char* data = url.data();
+    size_t size = url.size();
+    out.reserve(out.size() + size + size / 4);
+    size_t i = 0;
+    while (i < size) {
+        size_t run_end = i;
+#if USE_SSE2
+        run_end += url_safe_blocks(data + i, size - i);
+#endif
+        while (run_end < size &&
+                URL_SAFE[static_cast<unsigned char>(data[run_end])]) {
+            run_end += 1;
+        }
+        out.append(data + i, run_end - i);
+        i = run_end;
+        if (i < size) {
+            unsigned char c = data[i];
+            if (c == ' ') {
+                out += '+';
             } else {
-                // not a proper %XX with XX hexadecimal format
-                result << c;
+                char escaped[3] = {'%', HEX_UPPER[c >> 4], HEX_UPPER[c & 0xF]};
+                out.append(escaped, 3);
             }
-        } else {
-            result << c;
+            i += 1;
         }
     }
-    return result.str();
+}
+
+std::string urlencode(const std::string& url) {
+    std::string result;
+    urlencode(url, result);
+    return result;
+}
+
+void urldecode(const std::string& text, std::string& out) {
+    const char* data = text.data();
+    size_t size = text.size();
+    out.reserve(out.size() + size);
+    size_t i = 0;
+    while (i < size) {
+        size_t run_end = i;
+#if USE_SSE2
+        run_end += url_plain_blocks(data + i, size - i);
+#endif
+        while (run_end < size && data[run_end] != '%' && data[run_end] != '+') {
+            run_end += 1;
+        }
+        out.append(data + i, run_end - i);
+        i = run_end;
+        if (i < size) {
+            if (data[i] == '+') {
+                out += ' ';
+                i += 1;
+            } else if (i + 2 < size) {
+                int high = HEX_VALUE[static_cast<unsigned char>(data[i + 1])];
+                int low = HEX_VALUE[static_cast<unsigned char>(data[i + 2])];
+                if (high >= 0 && low >= 0) {
+                    out += char((high << 4) | low);
+                    i += 3;
+                } else {
+                    // not a proper %XX with XX hexadecimal format
+                    out += '%';
+                    i += 1;
+                }
+            } else {
+                out += '%';
+                i += 1;
+            }
+        }
+    }
+}
+
+std::string urldecode(const std::string& text) {
+    std::string result;
+    urldecode(text, result);
+    return result;
 }
 
 void set_hidden(WWidget* widget, bool hidden) {
@@ -341,37 +638,6 @@ std::string bool_to_string(bool value) {
 #define USE_WIOSERVICE (defined(WC_HAVE_WIOSERVICE) && \
         defined(WC_HAVE_ENVIRONMENT_SERVER))
 
-#if !USE_WIOSERVICE
-typedef boost::asio::deadline_timer Timer;
-typedef boost::shared_ptr<Timer> TimerPtr;
-
-struct WcIoService {
-    WcIoService():
-        work(new boost::asio::io_service::work(io)) {
-        for (int i = 0; i < boost::thread::hardware_concurrency(); i++) {
-            gr.create_thread(boost::bind(&boost::asio::io_service::run, &io));
-        }
-    }
-
-    ~WcIoService() {
-        delete work;
-        io.stop();
-    }
-
-    boost::asio::io_service io;
-    boost::asio::io_service::work* work;
-    boost::thread_group gr;
-} wc_io;
-
-static void handle_timeout(TimerPtr /* timer */,
-                           const boost::function<void()>& func,
-                           const boost::system::error_code& e) {
-    if (!e) {
-        func();
-    }
-}
-#endif
-
 void schedule_action(const td::TimeDuration& wait,
                      const boost::function<void()>& func) {
 #if USE_WIOSERVICE
@@ -382,9 +648,7 @@ void schedule_action(const td::TimeDuration& wait,
     WIOService& io = WServer::instance()->ioService();
     io.schedule(ms, func);
 #else
-    TimerPtr timer = boost::make_shared<Timer>(boost::ref(wc_io.io), wait);
-    timer->async_wait(boost::bind(handle_timeout, timer, func,
-                                  boost::asio::placeholders::error));
+    Executor::instance().schedule(wait, func);
 #endif
 }
 
@@ -464,22 +728,146 @@ void fix_text_edit(WTextEdit* text_edit) {
     }
 }
 
-std::string json_escape_utf8(const std::string& utf8) {
-    const std::wstring& wstr = WString().fromUTF8(utf8).value();
-    std::stringstream strm;
-    for (unsigned i = 0; i < wstr.size(); ++i) {
-        if (wstr[i] < 128) {
-            strm.put(char(wstr[i]));
-        } else {
-            strm.put('\\');
-            strm.put('u');
-            strm << std::hex
-                 << std::setfill('0')
-                 << std::setw(4)
-                 << short(wstr[i]);
+static const char HEX_LOWER[] = "0123456789abcdef";
+
+// return length of prefix of full 16-bytes blocks of ASCII chars
+static size_t ascii_blocks(const char* data, size_t size) {
+    size_t i = 0;
+#if USE_SSE2
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+    }
+#endif
+    return i;
+}
+
+// decode one non-ASCII code point, return its length (0 if malformed)
+static int decode_utf8(const unsigned char* s, size_t size, unsigned& cp) {
+    unsigned char c = s[0];
+    int length;
+    unsigned char min2 = 0x80, max2 = 0xBF; // allowed range of 2nd byte
+    if (c >= 0xC2 && c <= 0xDF) {
+        length = 2;
+        cp = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        length = 3;
+        cp = c & 0x0F;
+        if (c == 0xE0) {
+            min2 = 0xA0; // overlong
+        } else if (c == 0xED) {
+            max2 = 0x9F; // surrogates
+        }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        length = 4;
+        cp = c & 0x07;
+        if (c == 0xF0) {
+            min2 = 0x90; // overlong
+        } else if (c == 0xF4) {
+            max2 = 0x8F; // > U+10FFFF
+        }
+    } else {
+        return 0;
+    }
+    if (size < size_t(length) || s[1] < min2 || s[1] > max2) {
+        return 0;
+    }
+    for (int i = 1; i < length; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
         }
+        cp = (cp << 6) | (s[i] & 0x3F);
     }
-    return strm.str();
+    return length;
+}
+
+static void write_u_escape(char* buffer, unsigned unit) {
+    buffer[0] = '\\';
+    buffer[1] = 'u';
+    buffer[2] = HEX_LOWER[(unit >> 12) & 0xF];
+    buffer[3] = HEX_LOWER[(unit >> 8) & 0xF];
+    buffer[4] = HEX_LOWER[(unit >> 4) & 0xF];
+    buffer[5] = HEX_LOWER[unit & 0xF];
+}
+
+struct StringSink {
+    std::string& out;
+
+    StringSink(std::string& o):
+        out(o)
+    { }
+
+    void write(const char* data, size_t size) {
+        out.append(data, size);
+    }
+};
+
+struct StreamSink {
+    std::ostream& out;
+
+    StreamSink(std::ostream& o):
+        out(o)
+    { }
+
+    void write(const char* data, size_t size) {
+        out.write(data, size);
+    }
+};
+
+template<typename Sink>
+static void json_escape_utf8_impl(const std::string& utf8, Sink& sink) {
+    const char* data = utf8.data();
+    size_t size = utf8.size();
+    size_t i = 0;
+    while (i < size) {
+        size_t run_end = i + ascii_blocks(data + i, size - i);
+        while (run_end < size && (unsigned char)(data[run_end]) < 0x80) {
+            run_end += 1;
+        }
+        if (run_end != i) {
+            sink.write(data + i, run_end - i);
+            i = run_end;
+        }
+        if (i < size) {
+            const unsigned char* s = (const unsigned char*)(data + i);
+            unsigned cp;
+            int length = decode_utf8(s, size - i, cp);
+            if (length == 0) {
+                cp = 0xFFFD; // replacement character
+                length = 1;
+            }
+            char buffer[12];
+            if (cp < 0x10000) {
+                write_u_escape(buffer, cp);
+                sink.write(buffer, 6);
+            } else {
+                cp -= 0x10000;
+                write_u_escape(buffer, 0xD800 | (cp >> 10));
+                write_u_escape(buffer + 6, 0xDC00 | (cp & 0x3FF));
+                sink.write(buffer, 12);
+            }
+            i += length;
+        }
+    }
+}
+
+void json_escape_utf8(const std::string& utf8, std::string& out) {
+    out.reserve(out.size() + utf8.size());
+    StringSink sink(out);
+    json_escape_utf8_impl(utf8, sink);
+}
+
+void json_escape_utf8(const std::string& utf8, std::ostream& out) {
+    StreamSink sink(out);
+    json_escape_utf8_impl(utf8, sink);
+}
+
+std::string json_escape_utf8(const std::string& utf8) {
+    std::string result;
+    json_escape_utf8(utf8, result);
+    return result;
 }
 
 void scroll_to_last(WTableView* view) {
@@ -494,12 +882,75 @@ void scroll_to_last(WTableView* view) {
         }
 }
 
-int str2int(const std::string& str, int bad) {
-    try {
-        return boost::lexical_cast<int>(str);
-    } catch (boost::bad_lexical_cast&) {
-        return bad;
+template<typename T, typename U>
+static const char* parse_integer_impl(const char* first, const char* last,
+                                      T& value) {
+    // U is unsigned type for absolute value
+    const char* p = first;
+    bool negative = false;
+    if (p != last && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+    const U limit = negative ? U(std::numeric_limits<T>::max()) + 1 :
+                    U(std::numeric_limits<T>::max());
+    const char* digits = p;
+    U result = 0;
+    for (; p != last; ++p) {
+        unsigned digit = (unsigned char)(*p) - '0';
+        if (digit > 9) {
+            break;
+        }
+        if (result > (limit - digit) / 10) {
+            return first; // out of range
+        }
+        result = result * 10 + digit;
+    }
+    if (p == digits) {
+        return first; // no digits
+    }
+    if (negative) {
+        // avoid overflow of -T(result) when result == -min
+        value = result ? T(-T(result - 1) - 1) : T(0);
+    } else {
+        value = T(result);
+    }
+    return p;
+}
+
+const char* parse_integer(const char* first, const char* last, int& value) {
+    return parse_integer_impl<int, unsigned>(first, last, value);
+}
+
+const char* parse_integer(const char* first, const char* last,
+                          long long& value) {
+    return parse_integer_impl<long long, unsigned long long>(first, last,
+            value);
+}
+
+bool parse_integer(const std::string& str, int& value) {
+    const char* last = str.data() + str.size();
+    int result;
+    if (parse_integer(str.data(), last, result) == last && !str.empty()) {
+        value = result;
+        return true;
     }
+    return false;
+}
+
+bool parse_integer(const std::string& str, long long& value) {
+    const char* last = str.data() + str.size();
+    long long result;
+    if (parse_integer(str.data(), last, result) == last && !str.empty()) {
+        value = result;
+        return true;
+    }
+    return false;
+}
+
+int str2int(const std::string& str, int bad) {
+    int result;
+    return parse_integer(str, result) ? result : bad;
 }
 
 void fix_plain_anchors(int interval_ms,
@@ -598,6 +1049,7 @@ int wrun_stop_ioservice(int argc, char** argv, ApplicationCreator creator) {
         Wt::WServer::waitForShutdown();
         stop_ioservice(server);
         server.stop();
+        Executor::instance().shutdown();
         return 0;
     } else {
         return 1;
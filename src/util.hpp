@@ -8,10 +8,24 @@
 #ifndef WC_UTIL_HPP_
 #define WC_UTIL_HPP_
 
+#include <iosfwd>
+#include <boost/version.hpp>
 #include <boost/cast.hpp>
 #include <boost/function.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/any.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "boost-xtime.hpp"
+#include <boost/thread/mutex.hpp>
+
+#ifndef WC_USE_BOOST_ATOMIC
+#define WC_USE_BOOST_ATOMIC (BOOST_VERSION >= 105300)
+#endif
+#if WC_USE_BOOST_ATOMIC
+#include <boost/atomic.hpp>
+#endif
 
 #include <Wt/WGlobal>
 #include <Wt/WApplication> // for ApplicationCreator
@@ -105,16 +119,261 @@ This function is like bound_post(), but it allows to bind one argument.
 */
 OneAnyFunc one_bound_post(const OneAnyFunc& func, bool allow_merge = true);
 
+#ifndef DOXYGEN_ONLY
+/* Lock-free multi-producer queue.
+Producers push nodes onto an intrusive stack (CAS of the head).
+A consumer takes the whole stack at once, swapping the head with 0,
+and reverses it to restore FIFO order.
+Since nodes are never popped one by one from the shared head,
+there is no ABA problem.
+*/
+template <typename T>
+class MpscQueue {
+public:
+    struct Node {
+        Node(const T& v):
+            value(v), next(0)
+        { }
+
+        T value;
+        Node* next;
+    };
+
+    MpscQueue():
+        head_(0)
+    { }
+
+    ~MpscQueue() {
+        delete_list(take_all());
+    }
+
+    /* Add the value, return if the queue was empty */
+    bool push(const T& value) {
+        Node* node = new Node(value);
+#if WC_USE_BOOST_ATOMIC
+        Node* old_head = head_.load(boost::memory_order_relaxed);
+        do {
+            node->next = old_head;
+        } while (!head_.compare_exchange_weak(old_head, node,
+                                              boost::memory_order_release,
+                                              boost::memory_order_relaxed));
+#else
+        boost::mutex::scoped_lock lock(mutex_);
+        Node* old_head = head_;
+        node->next = old_head;
+        head_ = node;
+#endif
+        return old_head == 0;
+    }
+
+    /* Remove all nodes from the queue and return them (FIFO order) */
+    Node* take_all() {
+#if WC_USE_BOOST_ATOMIC
+        Node* list = head_.exchange(0, boost::memory_order_acquire);
+#else
+        Node* list;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            list = head_;
+            head_ = 0;
+        }
+#endif
+        Node* reversed = 0;
+        while (list) {
+            Node* next = list->next;
+            list->next = reversed;
+            reversed = list;
+            list = next;
+        }
+        return reversed;
+    }
+
+    static void delete_list(Node* list) {
+        while (list) {
+            Node* next = list->next;
+            delete list;
+            list = next;
+        }
+    }
+
+    /* Owner of a list of nodes, deletes nodes which were not popped */
+    class List {
+    public:
+        explicit List(Node* head):
+            head_(head)
+        { }
+
+        ~List() {
+            delete_list(head_);
+        }
+
+        /* Remove the first node and return it (0 if the list is empty) */
+        Node* pop() {
+            Node* node = head_;
+            if (node) {
+                head_ = node->next;
+            }
+            return node;
+        }
+
+    private:
+        Node* head_;
+
+        List(const List&);
+        List& operator=(const List&);
+    };
+
+private:
+#if WC_USE_BOOST_ATOMIC
+    boost::atomic<Node*> head_;
+#else
+    Node* head_;
+    boost::mutex mutex_;
+#endif
+
+    MpscQueue(const MpscQueue&);
+    MpscQueue& operator=(const MpscQueue&);
+};
+
+template <typename T>
+struct OneBoundData {
+    typedef typename MpscQueue<T>::Node Node;
+
+    OneBoundData(bool m):
+        allow_merge(m), pending(0)
+    { }
+
+    ~OneBoundData() {
+        MpscQueue<T>::delete_list(pending);
+    }
+
+    MpscQueue<T> queue;
+    bool allow_merge;
+    // nodes, taken from the queue, but not yet passed to func (no merge)
+    Node* pending;
+    boost::mutex pending_mutex;
+};
+
+template <typename T>
+struct OneBoundBinder {
+    typedef typename MpscQueue<T>::Node Node;
+
+    void operator()() {
+        OneBoundData<T>& data = *arg_ptr;
+        if (data.allow_merge) {
+            // if func throws, the rest of the list is deleted by the guard
+            typename MpscQueue<T>::List list(data.queue.take_all());
+            while (Node* n = list.pop()) {
+                boost::scoped_ptr<Node> node(n);
+                func(node->value);
+            }
+        } else {
+            // each push was posted separately: consume exactly one value.
+            // Binders of an app are serialized, but without app they
+            // can run concurrently, so pending list is locked
+            boost::scoped_ptr<Node> node;
+            {
+                boost::mutex::scoped_lock lock(data.pending_mutex);
+                if (!data.pending) {
+                    data.pending = data.queue.take_all();
+                }
+                if (!data.pending) {
+                    return;
+                }
+                node.reset(data.pending);
+                data.pending = data.pending->next;
+            }
+            func(node->value);
+        }
+    }
+
+    boost::function<void(const T&)> func;
+    boost::shared_ptr<OneBoundData<T> > arg_ptr;
+};
+
+template <typename T>
+struct OneBoundHolder {
+    void operator()(const T& arg) const {
+        bool was_empty = arg_ptr->queue.push(arg);
+        if (was_empty || !arg_ptr->allow_merge) {
+            posted_binder();
+        }
+    }
+
+    boost::function<void()> posted_binder;
+    boost::shared_ptr<OneBoundData<T> > arg_ptr;
+};
+#endif // DOXYGEN_ONLY
+
+/** Return the same function, but being called afterwards (typed version).
+\param func The function, called afterwards as if it is called in this app.
+\param allow_merge Whether sequential calls of returned functor
+    are allowed to be merged and executed through single post.
+
+This function is like one_bound_post(const OneAnyFunc&, bool),
+but the argument is stored as is, without boost::any boxing.
+The argument is copied once (to the queue) and passed to \p func
+by reference.
+
+\code
+boost::function<void(const std::string&)> poster =
+    one_bound_post<std::string>(boost::bind(&MyWidget::set_text, this, _1));
+\endcode
+
+\ingroup util
+*/
+template <typename T>
+boost::function<void(const T&)>
+one_bound_post(const boost::function<void(const T&)>& func,
+               bool allow_merge = true) {
+    OneBoundBinder<T> binder;
+    OneBoundHolder<T> holder;
+    binder.func = func;
+    binder.arg_ptr = boost::make_shared<OneBoundData<T> >(allow_merge);
+    holder.arg_ptr = binder.arg_ptr;
+    holder.posted_binder = bound_post(binder);
+    return holder;
+}
+
 /** Call triggerUpdate() in current WApplication, if updates are enabled.
 
 If !wApp or application is quited, does nothing.
 
+Calls of this function are coalesced: triggerUpdate() is called
+once the application has received no new calls for the window
+(or the max latency since the first merged call is exceeded).
+See set_updates_coalescing().
+
 \note This is only possible after a call to wApp->enableUpdates()
 
 \ingroup util
 */
 void updates_trigger();
 
+/** Call triggerUpdate() in current WApplication immediately.
+Unlike updates_trigger(), the call is not coalesced.
+
+If !wApp or application is quited or updates are disabled, does nothing.
+
+\ingroup util
+*/
+void updates_trigger_now();
+
+/** Set parameters of coalescing of updates_trigger() calls.
+\param window Calls of updates_trigger() for an application,
+    separated by less than this interval, result in one triggerUpdate().
+    TD_NULL disables coalescing.
+    Defaults to 30 milliseconds.
+\param max_latency Max delay of triggerUpdate() since first merged call.
+    Defaults to 100 milliseconds.
+
+These parameters are server-wide.
+
+\ingroup util
+*/
+void set_updates_coalescing(const td::TimeDuration& window,
+                            const td::TimeDuration& max_latency);
+
 /** Post updates_poster() to the application.
 If server.post() is available, it is used, else bound_post() is used.
 
@@ -139,7 +398,11 @@ std::string unique_filename();
 The convenience method for readConfigurationProperty().
 On error, \p def value is returned.
 
-\attention wApp should be defined, else the default would be returned.
+If ConfigRegistry::instance() was loaded, the value is taken from it
+(without wApp).
+
+\attention If ConfigRegistry::instance() was not loaded,
+    wApp should be defined, else the default would be returned.
 
 \ingroup util
 */
@@ -155,23 +418,64 @@ WDateTime now();
 /** Compute the MD5 message digest of the data (hex).
 Wt's built-in function or OpenSSL is used.
 
+To hash large data by parts, use Md5.
+
 \ingroup util
 */
 std::string md5(const std::string& data);
 #endif
 
+/** Write lowercase hex representation of the data to the buffer.
+The buffer must be at least 2 * size bytes long.
+No terminating zero is written.
+
+\see Md5
+
+\ingroup util
+*/
+void hex_encode(const void* data, size_t size, char* out);
+
+/** Return lowercase hex representation of the data.
+
+\ingroup util
+*/
+std::string hex_encode(const void* data, size_t size);
+
+/** Return lowercase hex representation of the data.
+
+\ingroup util
+*/
+std::string hex_encode(const std::string& data);
+
 /** URL-encodes string.
+Characters [a-zA-Z0-9._-] are kept as is, space is replaced with '+',
+other bytes are replaced with %XX (XX is uppercase hex).
 
 \ingroup util
 */
 std::string urlencode(const std::string& url);
 
+/** URL-encodes string and appends the result to the buffer.
+Unlike urlencode(const std::string&), this does not allocate new string
+for each call, if the buffer is reused.
+
+\ingroup util
+*/
+void urlencode(const std::string& url, std::string& out);
+
 /** URL-decodes string.
+Malformed %-sequences are kept as is.
 
 \ingroup util
 */
 std::string urldecode(const std::string& text);
 
+/** URL-decodes string and appends the result to the buffer.
+
+\ingroup util
+*/
+void urldecode(const std::string& text, std::string& out);
+
 /** Hides or shows the widget.
 This is a workaround for Wt 3.1.10 setHidden changes and forgotten default.
 
@@ -194,7 +498,7 @@ std::string bool_to_string(bool value);
     If sizeof(int) is 4, max duration is about 24.8 days.
 
 This function uses WIOService::schedule(), if available,
-else boost::asio::io_service with WApplication::UpdateLock is used.
+else Executor::instance() is used.
 \ingroup util
 */
 void schedule_action(const td::TimeDuration& wait,
@@ -262,14 +566,32 @@ If the size of WTextEdit was not set, it is set to 525x130 pp.
 */
 void fix_text_edit(WTextEdit* text_edit);
 
-/** Excape UTF-8 chars (>=128) with \uXXXX sequences for Json parser.
+/** Escape UTF-8 chars (>=128) with \uXXXX sequences for Json parser.
 This function does preprocessing of JSON, containing UTF-8 chars.
 (needed for Wt <= 3.2.2).
 
+Chars outside BMP are written as surrogate pairs (\uD83D\uDE00).
+Malformed UTF-8 sequences are replaced with \ufffd.
+ASCII chars are copied as is.
+
 \ingroup util
 */
 std::string json_escape_utf8(const std::string& utf8);
 
+/** Escape UTF-8 chars and append the result to the buffer.
+See json_escape_utf8(const std::string&).
+
+\ingroup util
+*/
+void json_escape_utf8(const std::string& utf8, std::string& out);
+
+/** Escape UTF-8 chars and write the result to the stream.
+See json_escape_utf8(const std::string&).
+
+\ingroup util
+*/
+void json_escape_utf8(const std::string& utf8, std::ostream& out);
+
 /** Scroll view to bottom (JavaScript + HTML versions).
 \warning Does nothing in HTML mode for earlier versions of Wt,
     lacking WTableView.pageCount and WTableView.setCurrentPage.
@@ -279,11 +601,52 @@ std::string json_escape_utf8(const std::string& utf8);
 void scroll_to_last(WTableView* view);
 
 /** Return interger or 'bad' if this string can not be interpreted as integer.
+The string must match parse_integer(const std::string&, int&).
 
 \ingroup util
 */
 int str2int(const std::string& str, int bad = -1);
 
+/** Parse integer from the beginning of chars [first, last).
+Accepted format is optional sign ('+' or '-') followed by decimal digits.
+Parsing stops at first non-digit char.
+
+On success, writes the number to \p value and returns the pointer
+to first char which was not parsed.
+If no number was found or the number does not fit type of \p value,
+returns \p first and does not change \p value.
+
+Unlike boost::lexical_cast, this function does not throw exceptions
+and does not allocate memory, so it is cheap to call it
+on strings which are not numbers.
+
+\ingroup util
+*/
+const char* parse_integer(const char* first, const char* last, int& value);
+
+/** Parse integer from the beginning of chars [first, last).
+See parse_integer(const char*, const char*, int&).
+
+\ingroup util
+*/
+const char* parse_integer(const char* first, const char* last,
+                          long long& value);
+
+/** Parse integer from the whole string.
+Returns if the string is an integer fitting type of \p value.
+On failure, \p value is not changed.
+
+\ingroup util
+*/
+bool parse_integer(const std::string& str, int& value);
+
+/** Parse integer from the whole string.
+See parse_integer(const std::string&, int&).
+
+\ingroup util
+*/
+bool parse_integer(const std::string& str, long long& value);
+
 /** Convert simple HTML anchors to Wt-like anchors.
 This function start JS setInterval with period \c interval_ms.
 Each time all simple anchors (created not by Wt things like WAnchor
@@ -337,7 +700,7 @@ std::string url_scheme(WApplication* app = 0);
 /** Try to stop ioservice and return if success */
 bool stop_ioservice(WServer& server);
 
-/** Run WServer, stop ioservice on exit */
+/** Run WServer, stop ioservice and Executor::instance() on exit */
 int wrun_stop_ioservice(int argc, char** argv, ApplicationCreator creator);
 
 }